@@ -0,0 +1,377 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "AudioReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::min;
+
+static inline unsigned int le16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int be16(const unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t le32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t be32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline float bitsToFloat(uint32_t bits)
+{
+  float value;
+  memcpy(&value, &bits, sizeof(float));
+  return value;
+}
+
+// for readers which produce audio some other way
+AudioReader::AudioReader()
+{
+  sndfile = NULL;
+  channels = 0;
+  bufferFrames = 0;
+  buffer = NULL;
+  mapping = NULL;
+  ownsMapping = false;
+}
+
+AudioReader::AudioReader(SNDFILE *sndfile_in, int channels_in,
+                         int bufferFrames_in)
+{
+  sndfile = sndfile_in;
+  channels = channels_in;
+  bufferFrames = bufferFrames_in;
+  buffer = new float[bufferFrames * channels];
+  mapping = NULL;
+  ownsMapping = false;
+}
+
+// read from a memory-mapped copy of the file where it holds uncompressed
+// 16-bit or float PCM, otherwise from sndfile
+AudioReader::AudioReader(string path, SNDFILE *sndfile_in, SF_INFO sfinfo,
+                         int bufferFrames_in)
+{
+  sndfile = sndfile_in;
+  channels = sfinfo.channels;
+  bufferFrames = bufferFrames_in;
+  buffer = new float[bufferFrames * channels];
+  mapping = NULL;
+  ownsMapping = false;
+  if (!mapFile(path, sfinfo) && mapping) {
+    munmap(mapping, mappingSize);
+    mapping = NULL;
+  }
+}
+
+// read straight from an image of the file in memory where it holds
+// uncompressed 16-bit or float PCM, otherwise from sndfile. the image must
+// outlive the reader
+AudioReader::AudioReader(const void *image, size_t size, SNDFILE *sndfile_in,
+                         SF_INFO sfinfo, int bufferFrames_in)
+{
+  sndfile = sndfile_in;
+  channels = sfinfo.channels;
+  bufferFrames = bufferFrames_in;
+  buffer = new float[bufferFrames * channels];
+  mapping = (unsigned char*)image;
+  mappingSize = size;
+  ownsMapping = false;
+  if (!findData(sfinfo)) mapping = NULL;
+}
+
+// read interleaved float frames which the caller keeps in memory for the
+// life of the reader
+AudioReader::AudioReader(const float *frames, sf_count_t count,
+                         int channels_in, int bufferFrames_in)
+{
+  sndfile = NULL;
+  channels = channels_in;
+  bufferFrames = bufferFrames_in;
+  buffer = NULL;
+  mapping = (unsigned char*)frames;
+  mappingSize = count * channels * sizeof(float);
+  ownsMapping = false;
+  data = mapping;
+  format = FLOAT_NATIVE;
+  dataFrames = count;
+  position = 0;
+  hinted = mappingSize;
+}
+
+AudioReader::~AudioReader()
+{
+  if (mapping && ownsMapping) munmap(mapping, mappingSize);
+  delete[] buffer;
+}
+
+bool AudioReader::mapFile(string path, SF_INFO sfinfo)
+{
+  int type = sfinfo.format & SF_FORMAT_TYPEMASK;
+  int subtype = sfinfo.format & SF_FORMAT_SUBMASK;
+  if (type != SF_FORMAT_WAV && type != SF_FORMAT_AIFF) return false;
+  if (subtype != SF_FORMAT_PCM_16 && subtype != SF_FORMAT_FLOAT) return false;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // tell the kernel the file will be read once from start to end
+  mappingSize = st.st_size;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  void *addr = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  mapping = (unsigned char*)addr;
+  ownsMapping = true;
+  madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+  return findData(sfinfo);
+}
+
+// locate the sample data of the file in the mapping
+bool AudioReader::findData(SF_INFO sfinfo)
+{
+  int type = sfinfo.format & SF_FORMAT_TYPEMASK;
+  int subtype = sfinfo.format & SF_FORMAT_SUBMASK;
+  if (type != SF_FORMAT_WAV && type != SF_FORMAT_AIFF) return false;
+  if (subtype != SF_FORMAT_PCM_16 && subtype != SF_FORMAT_FLOAT) return false;
+
+  size_t offset, size;
+  int bits;
+  bool isFloat, littleEndian = true;
+  if (type == SF_FORMAT_WAV) {
+    if (!findWavData(&offset, &size, &bits, &isFloat)) return false;
+  } else {
+    if (!findAiffData(&offset, &size, &bits, &isFloat, &littleEndian))
+      return false;
+  }
+
+  // check the header agrees with libsndfile
+  if (isFloat != (subtype == SF_FORMAT_FLOAT)) return false;
+  if (bits != (isFloat ? 32 : 16)) return false;
+  if (isFloat) format = littleEndian ? FLOAT_LE : FLOAT_BE;
+  else format = littleEndian ? PCM_16_LE : PCM_16_BE;
+
+  data = mapping + offset;
+  dataFrames = min((sf_count_t)(size / (channels * bits / 8)),
+                   sfinfo.frames);
+  position = 0;
+
+  // only the kernel's own mappings take hints
+  hinted = ownsMapping ? 0 : mappingSize;
+  return true;
+}
+
+bool AudioReader::findWavData(size_t *offset, size_t *size, int *bits,
+                              bool *isFloat)
+{
+  if (mappingSize < 12 || memcmp(mapping, "RIFF", 4) ||
+      memcmp(mapping + 8, "WAVE", 4)) return false;
+
+  bool haveFormat = false;
+  size_t pos = 12;
+  while (pos + 8 <= mappingSize)
+  {
+    const unsigned char *chunk = mapping + pos;
+    size_t length = le32(chunk + 4);
+
+    if (!memcmp(chunk, "fmt ", 4) && length >= 16) {
+      unsigned int tag = le16(chunk + 8);
+
+      // WAVE_FORMAT_EXTENSIBLE keeps the real tag in its sub-format GUID
+      if (tag == 0xFFFE && length >= 40) tag = le16(chunk + 8 + 24);
+      if (tag != 1 && tag != 3) return false;
+      *isFloat = (tag == 3);
+      *bits = le16(chunk + 8 + 14);
+      haveFormat = true;
+
+    } else if (!memcmp(chunk, "data", 4)) {
+      *offset = pos + 8;
+
+      // streamed files may leave the length unset
+      *size = mappingSize - *offset;
+      if (length > 0 && length < *size) *size = length;
+      return haveFormat;
+    }
+    pos += 8 + length + (length & 1);
+  }
+
+  return false;
+}
+
+bool AudioReader::findAiffData(size_t *offset, size_t *size, int *bits,
+                               bool *isFloat, bool *littleEndian)
+{
+  if (mappingSize < 12 || memcmp(mapping, "FORM", 4)) return false;
+  bool isAifc = !memcmp(mapping + 8, "AIFC", 4);
+  if (!isAifc && memcmp(mapping + 8, "AIFF", 4)) return false;
+
+  bool haveFormat = false;
+  size_t pos = 12;
+  while (pos + 8 <= mappingSize)
+  {
+    const unsigned char *chunk = mapping + pos;
+    size_t length = be32(chunk + 4);
+
+    if (!memcmp(chunk, "COMM", 4) && length >= 18) {
+      *bits = be16(chunk + 8 + 6);
+      *isFloat = false;
+      *littleEndian = false;
+
+      // AIFC names the sample encoding after the sample rate
+      if (isAifc && length >= 22) {
+        const unsigned char *compression = chunk + 8 + 18;
+        if (!memcmp(compression, "sowt", 4)) {
+          *littleEndian = true;
+        } else if (!memcmp(compression, "fl32", 4) ||
+                   !memcmp(compression, "FL32", 4)) {
+          *isFloat = true;
+        } else if (memcmp(compression, "NONE", 4)) {
+          return false;
+        }
+      }
+      haveFormat = true;
+
+    } else if (!memcmp(chunk, "SSND", 4)) {
+      // the chunk starts with the offset and block size of the samples, so
+      // a malformed one is left to libsndfile
+      if (length < 8 || pos + 16 > mappingSize) return false;
+      size_t skip = be32(chunk + 8);
+      if (skip > length - 8) return false;
+      *offset = pos + 16 + skip;
+      if (*offset > mappingSize) return false;
+      *size = min(length - 8 - skip, mappingSize - *offset);
+      return haveFormat;
+    }
+    pos += 8 + length + (length & 1);
+  }
+
+  return false;
+}
+
+// point *frames at the next block of interleaved frames, decoding it first
+// if need be
+//
+// the frames stay valid until the next call. returns the number of frames
+// read, 0 at the end of the file or -1 if decoding failed
+int AudioReader::read(const float **frames)
+{
+  if (mapping) return readMapped(frames);
+
+  sf_count_t count = sf_readf_float(sndfile, buffer, bufferFrames);
+  if (count < 0) {
+    cerr << "sf_readf_float failed: " << sf_strerror(sndfile) << endl;
+    return -1;
+  }
+  *frames = buffer;
+  return (int)count;
+}
+
+int AudioReader::readMapped(const float **frames)
+{
+  int count = min((sf_count_t)bufferFrames, dataFrames - position);
+  if (count <= 0) return 0;
+
+  int sampleBytes = (format == PCM_16_LE || format == PCM_16_BE) ? 2 : 4;
+  const unsigned char *src = data + position * channels * sampleBytes;
+  size_t end = (src - mapping) + (size_t)count * channels * sampleBytes;
+
+  // keep the kernel reading well ahead of us
+  if (end > hinted) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (src - mapping) / page * page;
+    size_t length = min((size_t)READ_AHEAD_BYTES, mappingSize - start);
+    madvise(mapping + start, length, MADV_WILLNEED);
+    hinted = start + length;
+  }
+  position += count;
+
+  // convert straight from the mapping
+  int samples = count * channels;
+  switch (format) {
+    case FLOAT_NATIVE:
+      *frames = (const float*)src;
+      return count;
+    case FLOAT_LE:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      if (((uintptr_t)src & (sizeof(float) - 1)) == 0) {
+        *frames = (const float*)src;
+        return count;
+      }
+#endif
+      for (int i = 0; i < samples; ++i)
+        buffer[i] = bitsToFloat(le32(src + i * 4));
+      break;
+    case FLOAT_BE:
+      for (int i = 0; i < samples; ++i)
+        buffer[i] = bitsToFloat(be32(src + i * 4));
+      break;
+    case PCM_16_LE:
+      for (int i = 0; i < samples; ++i)
+        buffer[i] = (int16_t)le16(src + i * 2) * (1.0f / 0x8000);
+      break;
+    case PCM_16_BE:
+      for (int i = 0; i < samples; ++i)
+        buffer[i] = (int16_t)be16(src + i * 2) * (1.0f / 0x8000);
+      break;
+  }
+  *frames = buffer;
+  return count;
+}
+
+// move back to the beginning of the file
+int AudioReader::rewind()
+{
+  return seek(0);
+}
+
+// move to a frame of the file
+int AudioReader::seek(sf_count_t frame)
+{
+  if (mapping) {
+    position = min(frame, dataFrames);
+    if (ownsMapping) hinted = 0;
+    return 0;
+  }
+  if (sf_seek(sndfile, frame, SEEK_SET) < 0) {
+    cerr << "sf_seek failed: " << sf_strerror(sndfile) << endl;
+    return 1;
+  }
+  return 0;
+}
+
+bool AudioReader::isMapped()
+{
+  return mapping != NULL;
+}
@@ -0,0 +1,77 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef AUDIOREADER_H
+#define AUDIOREADER_H
+
+#include <iostream>
+#include <string>
+#include <sndfile.h>
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+// number of frames decoded by each call to read()
+#define READ_BLOCK_SIZE 4096
+
+// bytes of a memory-mapped file to request ahead of the read position
+#define READ_AHEAD_BYTES (8 << 20)
+
+class AudioReader
+{
+  protected:
+    SNDFILE *sndfile;
+    int channels;
+    int bufferFrames;
+    float *buffer;
+
+    // uncompressed PCM read directly from a memory-mapped file, a file
+    // image held in memory by the caller or the caller's float frames
+    enum MappedFormat { PCM_16_LE, PCM_16_BE, FLOAT_LE, FLOAT_BE,
+                        FLOAT_NATIVE };
+    unsigned char *mapping;
+    size_t mappingSize;
+    bool ownsMapping;
+    const unsigned char *data;
+    MappedFormat format;
+    sf_count_t dataFrames;
+    sf_count_t position;
+    size_t hinted;
+    bool mapFile(string path, SF_INFO sfinfo);
+    bool findData(SF_INFO sfinfo);
+    bool findWavData(size_t *offset, size_t *size, int *bits, bool *isFloat);
+    bool findAiffData(size_t *offset, size_t *size, int *bits, bool *isFloat,
+                      bool *littleEndian);
+    int readMapped(const float **frames);
+    AudioReader();
+
+  public:
+    AudioReader(SNDFILE *sndfile, int channels,
+                int bufferFrames=READ_BLOCK_SIZE);
+    AudioReader(string path, SNDFILE *sndfile, SF_INFO sfinfo,
+                int bufferFrames=READ_BLOCK_SIZE);
+    AudioReader(const void *image, size_t size, SNDFILE *sndfile,
+                SF_INFO sfinfo, int bufferFrames=READ_BLOCK_SIZE);
+    AudioReader(const float *frames, sf_count_t count, int channels,
+                int bufferFrames=READ_BLOCK_SIZE);
+    virtual ~AudioReader();
+    virtual int read(const float **frames);
+    int rewind();
+    virtual int seek(sf_count_t frame);
+    bool isMapped();
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "AudioSource.h"
+#include "FeatureCache.h"
+
+#include <cstdio>
+#include <cstring>
+
+// a file image as libsndfile sees it through its virtual I/O interface
+struct MemoryFile
+{
+  const unsigned char *data;
+  sf_count_t size;
+  sf_count_t position;
+};
+
+static sf_count_t memoryLength(void *user)
+{
+  return ((MemoryFile*)user)->size;
+}
+
+static sf_count_t memorySeek(sf_count_t offset, int whence, void *user)
+{
+  MemoryFile *file = (MemoryFile*)user;
+  if (whence == SEEK_CUR) offset += file->position;
+  else if (whence == SEEK_END) offset += file->size;
+  if (offset < 0 || offset > file->size) return -1;
+  file->position = offset;
+  return offset;
+}
+
+static sf_count_t memoryRead(void *ptr, sf_count_t count, void *user)
+{
+  MemoryFile *file = (MemoryFile*)user;
+  if (count > file->size - file->position)
+    count = file->size - file->position;
+  memcpy(ptr, file->data + file->position, count);
+  file->position += count;
+  return count;
+}
+
+static sf_count_t memoryWrite(const void*, sf_count_t, void*)
+{
+  return 0;
+}
+
+static sf_count_t memoryTell(void *user)
+{
+  return ((MemoryFile*)user)->position;
+}
+
+// a reader which closes the file it reads, and frees the state libsndfile
+// reads a file image through, when it is deleted
+class OwningReader : public AudioReader
+{
+  protected:
+    MemoryFile *file;
+
+  public:
+    OwningReader(string path, SNDFILE *sndfile, SF_INFO sfinfo)
+      : AudioReader(path, sndfile, sfinfo), file(NULL) {}
+    OwningReader(MemoryFile *file_in, SNDFILE *sndfile, SF_INFO sfinfo)
+      : AudioReader(file_in->data, file_in->size, sndfile, sfinfo),
+        file(file_in) {}
+    ~OwningReader() {
+      sf_close(sndfile);
+      delete file;
+    }
+};
+
+AudioSource::AudioSource()
+{
+  image = NULL;
+  imageSize = 0;
+  frames = NULL;
+  frameCount = 0;
+  channels = 0;
+  sampleRate = 0;
+}
+
+AudioSource::AudioSource(string path_in)
+{
+  path = path_in;
+  image = NULL;
+  imageSize = 0;
+  frames = NULL;
+  frameCount = 0;
+  channels = 0;
+  sampleRate = 0;
+}
+
+// an audio file in any format libsndfile can read
+AudioSource::AudioSource(const void *image_in, size_t size)
+{
+  image = image_in;
+  imageSize = size;
+  frames = NULL;
+  frameCount = 0;
+  channels = 0;
+  sampleRate = 0;
+}
+
+AudioSource::AudioSource(const float *frames_in, sf_count_t count,
+                         int channels_in, int sampleRate_in)
+{
+  image = NULL;
+  imageSize = 0;
+  frames = frames_in;
+  frameCount = count;
+  channels = channels_in;
+  sampleRate = sampleRate_in;
+}
+
+// open a reader on the audio and describe it in *sfinfo, or return NULL
+// if it can't be read
+AudioReader *AudioSource::open(SF_INFO *sfinfo) const
+{
+  memset(sfinfo, 0, sizeof(SF_INFO));
+
+  if (frames) {
+    if (channels < 1 || sampleRate < 1 || frameCount < 0) {
+      cerr << "ERROR: Audio in memory needs at least one channel and a "
+        "positive sample rate." << endl;
+      return NULL;
+    }
+    sfinfo->frames = frameCount;
+    sfinfo->samplerate = sampleRate;
+    sfinfo->channels = channels;
+    sfinfo->format = SF_FORMAT_RAW | SF_FORMAT_FLOAT;
+    sfinfo->sections = 1;
+    sfinfo->seekable = 1;
+    return new AudioReader(frames, frameCount, channels);
+  }
+
+  if (image) {
+    SF_VIRTUAL_IO io;
+    io.get_filelen = memoryLength;
+    io.seek = memorySeek;
+    io.read = memoryRead;
+    io.write = memoryWrite;
+    io.tell = memoryTell;
+    MemoryFile *file = new MemoryFile;
+    file->data = (const unsigned char*)image;
+    file->size = imageSize;
+    file->position = 0;
+    SNDFILE *sndfile = sf_open_virtual(&io, SFM_READ, sfinfo, file);
+    if (!sndfile) {
+      cerr << "ERROR: Failed to open audio in memory: "
+        << sf_strerror(sndfile) << endl;
+      delete file;
+      return NULL;
+    }
+    return new OwningReader(file, sndfile, *sfinfo);
+  }
+
+  SNDFILE *sndfile = sf_open(path.c_str(), SFM_READ, sfinfo);
+  if (!sndfile) {
+    cerr << "ERROR: Failed to open input file \""
+      << path << "\": " << sf_strerror(sndfile) << endl;
+    return NULL;
+  }
+  return new OwningReader(path, sndfile, *sfinfo);
+}
+
+// hash of the audio for looking up cached features, or an empty string if
+// it can't be read
+string AudioSource::hash() const
+{
+  if (frames) {
+    char format[32];
+    snprintf(format, sizeof(format), "-%dx%d", channels, sampleRate);
+    return FeatureCache::hashMemory(frames,
+      frameCount * channels * sizeof(float)) + format;
+  }
+  if (image) return FeatureCache::hashMemory(image, imageSize);
+  return FeatureCache::hashFile(path);
+}
@@ -0,0 +1,50 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef AUDIOSOURCE_H
+#define AUDIOSOURCE_H
+
+#include "AudioReader.h"
+#include <string>
+
+using std::string;
+
+// Where the audio to be analysed comes from: a file, an image of an audio
+// file held in memory, or interleaved float frames held in memory. Memory
+// is not copied, so it must stay valid while readers are open on it. Each
+// call to open() gives a reader with its own position, so that worker
+// threads can read the same audio independently.
+class AudioSource
+{
+  protected:
+    string path;
+    const void *image;
+    size_t imageSize;
+    const float *frames;
+    sf_count_t frameCount;
+    int channels;
+    int sampleRate;
+
+  public:
+    AudioSource();
+    AudioSource(string path);
+    AudioSource(const void *image, size_t size);
+    AudioSource(const float *frames, sf_count_t count, int channels,
+                int sampleRate);
+    AudioReader *open(SF_INFO *sfinfo) const;
+    string hash() const;
+};
+
+#endif
@@ -0,0 +1,216 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Batch.h"
+#include "PNGWriter.h"
+#include <fstream>
+#include <sstream>
+
+// runs one worker's share of the batch on a pool thread
+class WorkerTask : public ThreadPool::Task
+{
+  public:
+    Batch *batch;
+    int worker;
+
+    WorkerTask(Batch *batch_in, int worker_in)
+      : batch(batch_in), worker(worker_in) {}
+
+    void run() {
+      batch->work(worker);
+    }
+};
+
+// jobs are rendered with the analysis settings of the given host
+Batch::Batch(string pluginPath_in, const VisHost &settings_in)
+  : settings(settings_in)
+{
+  pluginPath = pluginPath_in;
+  completed = 0;
+  pthread_mutex_init(&outputLock, NULL);
+}
+
+Batch::~Batch()
+{
+  for (unsigned int w=0; w<locks.size(); w++)
+    pthread_mutex_destroy(&locks[w]);
+  pthread_mutex_destroy(&outputLock);
+}
+
+// read a manifest with one job per line, giving the input file, the output
+// PNG file and optionally a size, which defaults to width x height. blank
+// lines and lines starting with # are ignored
+int Batch::load(string manifest, int width, int height)
+{
+  ifstream file(manifest.c_str());
+  if (!file) {
+    cerr << "ERROR: Could not open batch manifest \"" << manifest << "\"."
+      << endl;
+    return 1;
+  }
+
+  string text;
+  int line = 0;
+  while (getline(file, text))
+  {
+    line++;
+    istringstream fields(text);
+    BatchJob job;
+    string size;
+    if (!(fields >> job.input) || job.input[0] == '#') continue;
+    if (!(fields >> job.output)) {
+      cerr << "ERROR: Line " << line << " of batch manifest has no output "
+        << "file." << endl;
+      return 1;
+    }
+
+    // parse size
+    job.width = width;
+    job.height = height;
+    if (fields >> size) {
+      istringstream ss(size);
+      string widthStr, heightStr;
+      getline(ss, widthStr, 'x');
+      getline(ss, heightStr);
+      job.width = job.height = 0;
+      istringstream(widthStr) >> job.width;
+      istringstream(heightStr) >> job.height;
+      if (job.width <= 0 || job.height <= 0) {
+        cerr << "ERROR: Could not parse size on line " << line
+          << " of batch manifest." << endl;
+        return 1;
+      }
+    }
+    if ((size_t)job.width * job.height > MAX_IMAGE_BYTES / BYTES_PER_PIXEL) {
+      cerr << "ERROR: Size on line " << line << " of batch manifest is "
+        << "too large." << endl;
+      return 1;
+    }
+
+    job.line = line;
+    job.status = -1;
+    jobs.push_back(job);
+  }
+
+  return 0;
+}
+
+// render every job on the given number of threads, returning non-zero if
+// any of them failed
+int Batch::run(int workers)
+{
+  if (jobs.empty()) return 0;
+  workers = max(1, min(workers, (int)jobs.size()));
+
+  // hand each worker a contiguous run of jobs
+  queues.assign(workers, deque<int>());
+  locks.resize(workers);
+  for (int w=0; w<workers; w++)
+    pthread_mutex_init(&locks[w], NULL);
+  for (unsigned int j=0; j<jobs.size(); j++)
+    queues[(long)j * workers / jobs.size()].push_back(j);
+
+  vector<WorkerTask*> tasks;
+  ThreadPool pool(workers > 1 ? workers : 0);
+  for (int w=0; w<workers; w++) {
+    tasks.push_back(new WorkerTask(this, w));
+    pool.add(tasks.back());
+  }
+  pool.wait();
+  for (int w=0; w<workers; w++)
+    delete tasks[w];
+
+  // report the jobs which failed, or were never run because no worker
+  // could load the plugin
+  int failed = 0;
+  for (unsigned int j=0; j<jobs.size(); j++)
+    if (jobs[j].status) failed++;
+  if (failed) {
+    cerr << "ERROR: " << failed << " of " << jobs.size()
+      << " batch jobs failed." << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// take the next job from the front of a worker's own queue, or else from
+// the back of another's
+bool Batch::next(int worker, int *job)
+{
+  int workers = queues.size();
+  for (int i=0; i<workers; i++)
+  {
+    int w = (worker + i) % workers;
+    pthread_mutex_lock(&locks[w]);
+    bool found = !queues[w].empty();
+    if (found) {
+      if (i == 0) {
+        *job = queues[w].front();
+        queues[w].pop_front();
+      } else {
+        *job = queues[w].back();
+        queues[w].pop_back();
+      }
+    }
+    pthread_mutex_unlock(&locks[w]);
+    if (found) return true;
+  }
+  return false;
+}
+
+// render jobs with this worker's own host until there are none left
+void Batch::work(int worker)
+{
+  VisHost host(pluginPath);
+  host.copySettings(settings);
+  host.verbose = false;
+  host.jobs = 1;
+  if (host.init()) return;
+
+  int j;
+  while (next(worker, &j))
+  {
+    BatchJob &job = jobs[j];
+    job.status = render(host, job);
+
+    pthread_mutex_lock(&outputLock);
+    completed++;
+    if (job.status) {
+      cerr << "ERROR: Batch job on line " << job.line << " (" << job.input
+        << ") failed." << endl;
+    } else if (settings.verbose) {
+      cout << " * [" << completed << "/" << jobs.size() << "] " << job.input
+        << " -> " << job.output << endl;
+    }
+    pthread_mutex_unlock(&outputLock);
+  }
+}
+
+int Batch::render(VisHost &host, BatchJob &job)
+{
+  if (host.process(job.input)) return 1;
+
+  vector<unsigned char> buffer((size_t)job.width * job.height *
+                               BYTES_PER_PIXEL);
+  if (host.render(job.width, job.height, &buffer[0])) return 1;
+
+  int format = settings.imageFormat;
+  if (format == IMAGE_AUTO) format = ImageWriter::formatOf(job.output);
+  ImageWriter *writer = ImageWriter::create(format, job.width, job.height,
+                                            &buffer[0], settings.png);
+  int status = writer->write(job.output.c_str());
+  delete writer;
+  return status;
+}
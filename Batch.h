@@ -0,0 +1,63 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "VisHost.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// one file to render in batch mode
+struct BatchJob
+{
+  string input;
+  string output;
+  int width;
+  int height;
+  int line;     // of the manifest, for error messages
+  int status;
+};
+
+// Renders a list of audio files with one resident VisHost per worker
+// thread, so that the visualisation plugin and Vamp plugins are loaded
+// once rather than for every file. Each worker starts with a contiguous run
+// of the jobs, which tend to share a sample rate and so reuse the same Vamp
+// plugin instances, and takes jobs from the back of other workers' queues
+// once its own is empty.
+class Batch
+{
+  protected:
+    string pluginPath;
+    const VisHost &settings;
+    vector<BatchJob> jobs;
+    vector<deque<int> > queues;
+    vector<pthread_mutex_t> locks;
+    pthread_mutex_t outputLock;
+    int completed;
+    bool next(int worker, int *job);
+    int render(VisHost &host, BatchJob &job);
+
+  public:
+    Batch(string pluginPath, const VisHost &settings);
+    ~Batch();
+    int load(string manifest, int width, int height);
+    int run(int workers);
+    void work(int worker);
+};
+
+#endif
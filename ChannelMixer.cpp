@@ -0,0 +1,128 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "ChannelMixer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+ChannelMixer::ChannelMixer(int inputChannels_in, int mode_in)
+{
+  inputChannels = inputChannels_in;
+  mode = mode_in;
+
+  // a mono file needs no mixing
+  if (inputChannels == 1) mode = VAMP_ALL_CHANNELS;
+}
+
+int ChannelMixer::getOutputChannels()
+{
+  return (mode == VAMP_ALL_CHANNELS) ? inputChannels : 1;
+}
+
+// write count frames to the output channels
+void ChannelMixer::mix(const float *frames, int count, float **out)
+{
+  if (mode == VAMP_ALL_CHANNELS) deinterleave(frames, count, out);
+  else if (mode == VAMP_DOWNMIX) downmix(frames, count, out[0]);
+  else select(frames, count, mode - 1, out[0]);
+}
+
+void ChannelMixer::deinterleave(const float *frames, int count, float **out)
+{
+  int j = 0;
+
+  if (inputChannels == 1) {
+    for (; j < count; ++j) out[0][j] = frames[j];
+    return;
+  }
+
+  // split stereo four frames at a time
+  if (inputChannels == 2) {
+    float *left = out[0];
+    float *right = out[1];
+#if defined(__SSE2__)
+    for (; j + 4 <= count; j += 4) {
+      __m128 a = _mm_loadu_ps(frames + 2 * j);
+      __m128 b = _mm_loadu_ps(frames + 2 * j + 4);
+      _mm_storeu_ps(left + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+      _mm_storeu_ps(right + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+    }
+#elif defined(__ARM_NEON)
+    for (; j + 4 <= count; j += 4) {
+      float32x4x2_t lr = vld2q_f32(frames + 2 * j);
+      vst1q_f32(left + j, lr.val[0]);
+      vst1q_f32(right + j, lr.val[1]);
+    }
+#endif
+    for (; j < count; ++j) {
+      left[j] = frames[2 * j];
+      right[j] = frames[2 * j + 1];
+    }
+    return;
+  }
+
+  for (int c = 0; c < inputChannels; ++c) {
+    float *channel = out[c];
+    const float *in = frames + c;
+    for (j = 0; j < count; ++j) channel[j] = in[j * inputChannels];
+  }
+}
+
+// average all of the channels
+void ChannelMixer::downmix(const float *frames, int count, float *out)
+{
+  int j = 0;
+
+  if (inputChannels == 2) {
+#if defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; j + 4 <= count; j += 4) {
+      __m128 a = _mm_loadu_ps(frames + 2 * j);
+      __m128 b = _mm_loadu_ps(frames + 2 * j + 4);
+      __m128 sum = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)),
+                              _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+      _mm_storeu_ps(out + j, _mm_mul_ps(sum, half));
+    }
+#elif defined(__ARM_NEON)
+    for (; j + 4 <= count; j += 4) {
+      float32x4x2_t lr = vld2q_f32(frames + 2 * j);
+      vst1q_f32(out + j, vmulq_n_f32(vaddq_f32(lr.val[0], lr.val[1]), 0.5f));
+    }
+#endif
+    for (; j < count; ++j)
+      out[j] = (frames[2 * j] + frames[2 * j + 1]) * 0.5f;
+    return;
+  }
+
+  // sum channel by channel so that the inner loops stay vectorisable
+  const float scale = 1.0f / inputChannels;
+  for (j = 0; j < count; ++j) out[j] = frames[j * inputChannels];
+  for (int c = 1; c < inputChannels; ++c) {
+    const float *in = frames + c;
+    for (j = 0; j < count; ++j) out[j] += in[j * inputChannels];
+  }
+  for (j = 0; j < count; ++j) out[j] *= scale;
+}
+
+void ChannelMixer::select(const float *frames, int count, int channel,
+                          float *out)
+{
+  const float *in = frames + channel;
+  for (int j = 0; j < count; ++j) out[j] = in[j * inputChannels];
+}
@@ -0,0 +1,39 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef CHANNELMIXER_H
+#define CHANNELMIXER_H
+
+#include "VisPlugin.h"
+
+// Converts interleaved frames from the file into the de-interleaved
+// channels given to a Vamp plugin, either passing every channel through,
+// mixing them down to mono or picking out a single channel.
+class ChannelMixer
+{
+  protected:
+    int inputChannels;
+    int mode;
+    void deinterleave(const float *frames, int count, float **out);
+    void downmix(const float *frames, int count, float *out);
+    void select(const float *frames, int count, int channel, float *out);
+
+  public:
+    ChannelMixer(int inputChannels, int mode=VAMP_DOWNMIX);
+    int getOutputChannels();
+    void mix(const float *frames, int count, float **out);
+};
+
+#endif
@@ -0,0 +1,415 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Daemon.h"
+#include "PNGWriter.h"
+#include "ImageWriter.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <sstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// set by SIGINT or SIGTERM to shut the daemon down
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+  stopRequested = 1;
+}
+
+// runs requests from the queue on a pool thread until the daemon stops
+class DaemonTask : public ThreadPool::Task
+{
+  public:
+    Daemon *daemon;
+
+    DaemonTask(Daemon *daemon_in) : daemon(daemon_in) {}
+
+    void run() {
+      daemon->work();
+    }
+};
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+  const char *p = (const char*)data;
+  while (size > 0) {
+    ssize_t n = ::write(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static void reply(int client, string text)
+{
+  text += "\n";
+  writeAll(client, text.data(), text.size());
+}
+
+// requests are rendered with the analysis settings of the given host, and
+// with the first of pluginPaths and width x height unless they say
+// otherwise; outputs are only written into outputDir, if there is one
+Daemon::Daemon(string socketPath_in, vector<string> pluginPaths_in,
+               string outputDir_in, const VisHost &settings_in, int width_in,
+               int height_in, int queueSize_in)
+  : settings(settings_in)
+{
+  socketPath = socketPath_in;
+  pluginPaths = pluginPaths_in;
+  outputDir = outputDir_in;
+  width = width_in;
+  height = height_in;
+  queueSize = queueSize_in;
+  stopping = false;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&notEmpty, NULL);
+  pthread_cond_init(&notFull, NULL);
+}
+
+Daemon::~Daemon()
+{
+  pthread_cond_destroy(&notFull);
+  pthread_cond_destroy(&notEmpty);
+  pthread_mutex_destroy(&mutex);
+}
+
+// create the listening socket, returning its descriptor or -1
+int Daemon::listen()
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    cerr << "ERROR: Socket path is too long." << endl;
+    return -1;
+  }
+  strcpy(addr.sun_path, socketPath.c_str());
+
+  // replace a socket left behind by a previous run, but nothing else
+  struct stat st;
+  if (lstat(socketPath.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      cerr << "ERROR: " << socketPath << " exists and is not a socket."
+        << endl;
+      return -1;
+    }
+    unlink(socketPath.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      ::listen(fd, queueSize) != 0) {
+    cerr << "ERROR: Could not listen on " << socketPath << ": "
+      << strerror(errno) << endl;
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  // clients can read any file the daemon can, so only the owner and group
+  // may connect
+  chmod(socketPath.c_str(), 0660);
+  return fd;
+}
+
+// accept connections until SIGINT or SIGTERM, handling them on the given
+// number of worker threads
+int Daemon::run(int workers)
+{
+  int fd = listen();
+  if (fd < 0) return 1;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  vector<DaemonTask*> tasks;
+  ThreadPool pool(workers);
+  for (int w=0; w<workers; w++) {
+    tasks.push_back(new DaemonTask(this));
+    pool.add(tasks.back());
+  }
+  if (settings.verbose) cout << " * Listening on " << socketPath << " with "
+    << workers << " workers" << endl;
+
+  // poll so that a signal between checks can't leave us blocked in accept
+  while (!stopRequested)
+  {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 500) <= 0) continue;
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) continue;
+    push(client);
+  }
+
+  // let the workers finish the queued requests
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&notEmpty);
+  pthread_mutex_unlock(&mutex);
+  pool.wait();
+  for (int w=0; w<workers; w++)
+    delete tasks[w];
+
+  close(fd);
+  unlink(socketPath.c_str());
+  if (settings.verbose) cout << " * Stopped" << endl;
+  return 0;
+}
+
+// queue a connection, waiting while the queue is full
+void Daemon::push(int client)
+{
+  pthread_mutex_lock(&mutex);
+  while ((int)queue.size() >= queueSize)
+    pthread_cond_wait(&notFull, &mutex);
+  queue.push_back(client);
+  pthread_cond_signal(&notEmpty);
+  pthread_mutex_unlock(&mutex);
+}
+
+// take the next connection, or -1 once the daemon is stopping and the queue
+// is empty
+int Daemon::pop()
+{
+  pthread_mutex_lock(&mutex);
+  while (queue.empty() && !stopping)
+    pthread_cond_wait(&notEmpty, &mutex);
+  int client = -1;
+  if (!queue.empty()) {
+    client = queue.front();
+    queue.pop_front();
+    pthread_cond_signal(&notFull);
+  }
+  pthread_mutex_unlock(&mutex);
+  return client;
+}
+
+void Daemon::work()
+{
+  map<string, VisHost*> hosts;
+  int client;
+  while ((client = pop()) >= 0)
+  {
+    handle(client, hosts);
+    close(client);
+  }
+  for (map<string, VisHost*>::iterator h=hosts.begin(); h!=hosts.end(); h++)
+    delete h->second;
+}
+
+// the path of the plugin a request names by its path or file name, or ""
+// if the daemon wasn't started with it
+string Daemon::findPlugin(string name)
+{
+  for (unsigned int p = 0; p < pluginPaths.size(); p++)
+  {
+    string path = pluginPaths[p];
+    size_t slash = path.rfind('/');
+    string file = (slash == string::npos) ? path : path.substr(slash + 1);
+    if (name == path || name == file) return path;
+  }
+  return "";
+}
+
+// read and render one request
+int Daemon::handle(int client, map<string, VisHost*> &hosts)
+{
+  // don't let a client which stops reading or writing hold up the worker
+  struct timeval readTimeout = { DAEMON_READ_TIMEOUT, 0 };
+  struct timeval writeTimeout = { DAEMON_WRITE_TIMEOUT, 0 };
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &readTimeout,
+             sizeof(readTimeout));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &writeTimeout,
+             sizeof(writeTimeout));
+
+  // read the request line, along with any descriptor sent with it. the
+  // kernel installs every descriptor sent, so any beyond the first are
+  // closed, and a request whose descriptors didn't all fit is refused
+  char request[DAEMON_REQUEST_SIZE];
+  size_t length = 0;
+  int inputFd = -1;
+  bool truncated = false;
+  while (length < sizeof(request) && !memchr(request, '\n', length))
+  {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { request + length, sizeof(request) - length };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(client, &msg, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    length += n;
+
+    if (msg.msg_flags & MSG_CTRUNC) truncated = true;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+      size_t fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < fds; i++) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        if (inputFd < 0) inputFd = fd;
+        else close(fd);
+      }
+    }
+  }
+  if (truncated) {
+    if (inputFd >= 0) close(inputFd);
+    reply(client, "ERROR too many descriptors");
+    return 1;
+  }
+  char *end = (char*)memchr(request, '\n', length);
+  if (!end) {
+    if (inputFd >= 0) close(inputFd);
+    reply(client, "ERROR incomplete request");
+    return 1;
+  }
+
+  // parse the fields
+  string input, output, plugin = pluginPaths[0], format;
+  int w = width, h = height;
+  istringstream fields(string(request, end));
+  string field;
+  while (fields >> field)
+  {
+    size_t eq = field.find('=');
+    string key = field.substr(0, eq);
+    string value = (eq == string::npos) ? "" : field.substr(eq + 1);
+    if (key == "input") input = value;
+    else if (key == "output") output = value;
+    else if (key == "plugin") plugin = findPlugin(value);
+    else if (key == "format") format = value;
+    else if (key == "size") {
+      char x;
+      istringstream size(value);
+      if (!(size >> w >> x >> h) || x != 'x') w = h = 0;
+    } else {
+      reply(client, "ERROR unknown field " + key);
+      if (inputFd >= 0) close(inputFd);
+      return 1;
+    }
+  }
+
+  // a descriptor is read through its /proc entry, so that it can be opened
+  // again like any other path
+  if (input == "-" && inputFd >= 0) {
+    ostringstream path;
+    path << "/proc/self/fd/" << inputFd;
+    input = path.str();
+  }
+
+  string error;
+  if (input == "" || input == "-") error = "no input";
+  else if (plugin == "") error = "unknown plugin";
+  else if (output != "" && outputDir == "") error = "no output directory";
+  else if (output != "" && (output.find('/') != string::npos ||
+                            output == "." || output == ".."))
+    error = "bad output";
+  else if (w <= 0 || h <= 0 ||
+           (size_t)w * h > MAX_IMAGE_BYTES / BYTES_PER_PIXEL)
+    error = "bad size";
+  else if (format != "" && ImageWriter::parseFormat(format) < 0)
+    error = "bad format";
+
+  // load the visualisation plugin the first time this worker needs it
+  VisHost *host = NULL;
+  if (error == "") {
+    host = hosts[plugin];
+    if (!host) {
+      host = new VisHost(plugin);
+      host->copySettings(settings);
+      host->verbose = false;
+      host->jobs = 1;
+      if (host->init()) {
+        delete host;
+        host = NULL;
+        error = "could not load plugin";
+      }
+      hosts[plugin] = host;
+    }
+  }
+
+  vector<unsigned char> buffer(error == "" ?
+                               (size_t)w * h * BYTES_PER_PIXEL : 0);
+  if (error == "" && host->process(input)) error = "could not process audio";
+  if (error == "" && host->render(w, h, &buffer[0]))
+    error = "could not render visualisation";
+  if (inputFd >= 0) close(inputFd);
+  if (error != "") {
+    reply(client, "ERROR " + error);
+    return 1;
+  }
+
+  // without a format field, the format is the daemon's, or else that of
+  // the output file name or PNG
+  int imageFormat = format != "" ? ImageWriter::parseFormat(format) :
+    settings.imageFormat;
+  if (imageFormat == IMAGE_AUTO)
+    imageFormat = output != "" ? ImageWriter::formatOf(output) : IMAGE_PNG;
+  ImageWriter *writer = ImageWriter::create(imageFormat, w, h, &buffer[0],
+                                            settings.png);
+
+  // write the image to a file in the output directory
+  if (output != "") {
+    int status = writer->write((outputDir + "/" + output).c_str());
+    delete writer;
+    reply(client, status ? "ERROR could not write output" : "OK");
+    return status;
+  }
+
+  // or send raw pixels back straight after the reply
+  static const char *names[] = { "png", "argb", "ppm", "pam", "qoi" };
+  ostringstream header;
+  header << "OK " << names[imageFormat];
+  if (imageFormat == IMAGE_RAW) {
+    delete writer;
+    header << " " << w << "x" << h << "\n";
+    string text = header.str();
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)text.data();
+    iov[0].iov_len = text.size();
+    iov[1].iov_base = &buffer[0];
+    iov[1].iov_len = buffer.size();
+    return !ImageWriter::writeAll(client, iov, 2);
+  }
+
+  // or encoded
+  reply(client, header.str());
+  FILE *stream = fdopen(dup(client), "wb");
+  int status = 1;
+  if (stream) {
+    status = writer->write(stream);
+    if (fclose(stream) != 0) status = 1;
+  }
+  delete writer;
+  return status;
+}
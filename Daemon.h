@@ -0,0 +1,86 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "VisHost.h"
+#include <deque>
+#include <map>
+#include <string>
+#include <pthread.h>
+
+// size of the largest request line
+#define DAEMON_REQUEST_SIZE 4096
+
+// seconds a client has to send its request
+#define DAEMON_READ_TIMEOUT 10
+
+// seconds a client has to take each part of its reply
+#define DAEMON_WRITE_TIMEOUT 10
+
+// Renders requests received over a Unix domain socket, keeping the plugins
+// loaded between them. Each connection carries one request line of
+// key=value fields:
+//
+//   input=<path> plugin=<library.so> size=<width>x<height>
+//   output=<name> format=png|argb|raw|ppm|pam|qoi
+//
+// Only input is required. Instead of a path, the input can be sent as a
+// file descriptor with the request (input=-), of which only the first sent
+// is kept. The plugin must be one of those the daemon was started with,
+// given by its path or file name, so that clients can't make the daemon
+// load other libraries. An output is a
+// file name in the daemon's output directory, and is refused if the daemon
+// has none. Without an output the image is sent back on the connection
+// after an "OK <format>" line, or "OK argb <width>x<height>" for raw
+// pixels; otherwise the reply is "OK". Without a format, the output file's
+// extension decides. Images larger than MAX_IMAGE_BYTES are refused. Errors
+// are reported with an "ERROR <message>" line.
+//
+// Accepted connections wait in a bounded queue for one of the workers, each
+// of which keeps its own VisHost for every visualisation plugin it has
+// used. Once the queue is full, connections are left in the socket's
+// backlog until a worker is free.
+class Daemon
+{
+  protected:
+    string socketPath;
+    vector<string> pluginPaths;
+    string outputDir;
+    const VisHost &settings;
+    int width;
+    int height;
+    int queueSize;
+    std::deque<int> queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    bool stopping;
+    int listen();
+    void push(int client);
+    int pop();
+    int handle(int client, std::map<string, VisHost*> &hosts);
+    string findPlugin(string name);
+
+  public:
+    Daemon(string socketPath, vector<string> pluginPaths, string outputDir,
+           const VisHost &settings, int width, int height, int queueSize);
+    ~Daemon();
+    int run(int workers);
+    void work();
+};
+
+#endif
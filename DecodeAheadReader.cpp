@@ -0,0 +1,187 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "DecodeAheadReader.h"
+
+#include <cstring>
+
+DecodeAheadReader::DecodeAheadReader(AudioReader &source_in, int channels_in,
+                                     int slots_in)
+  : source(source_in), slots(slots_in), head(0), tail(0), sleepers(0),
+    stopping(false)
+{
+  channels = channels_in;
+  if (slots < 2) slots = 2;
+  blocks.resize(slots);
+  for (int s = 0; s < slots; ++s)
+    blocks[s].resize((size_t)READ_BLOCK_SIZE * channels);
+  counts.resize(slots);
+  holding = false;
+  running = false;
+  direct = false;
+  limit = -1;
+  produced = 0;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&wake, NULL);
+}
+
+DecodeAheadReader::~DecodeAheadReader()
+{
+  stop();
+  pthread_cond_destroy(&wake);
+  pthread_mutex_destroy(&mutex);
+}
+
+// start decoding from the source's current position
+void DecodeAheadReader::start()
+{
+  head = 0;
+  tail = 0;
+  holding = false;
+  stopping = false;
+  produced = 0;
+  running = pthread_create(&thread, NULL, worker, this) == 0;
+
+  // without a thread of its own, the source is read as it would have been
+  direct = !running;
+  if (direct) cerr << "WARNING: Could not start decoding thread" << endl;
+}
+
+// stop the producer, leaving the source wherever it had got to
+void DecodeAheadReader::stop()
+{
+  if (!running) return;
+  stopping = true;
+  pthread_mutex_lock(&mutex);
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&mutex);
+  pthread_join(thread, NULL);
+  running = false;
+}
+
+void *DecodeAheadReader::worker(void *reader)
+{
+  ((DecodeAheadReader*)reader)->produce();
+  return NULL;
+}
+
+// decode each block into the next free buffer until the end of the audio.
+// the block the caller holds is never among those the producer can reach,
+// as it isn't released until the caller reads the next one
+void DecodeAheadReader::produce()
+{
+  for (;;) {
+    unsigned int filled = head.load(std::memory_order_relaxed);
+    while (!ready(true)) {
+      if (stopping) return;
+      sleep(true);
+    }
+    if (stopping) return;
+
+    // the end of the frames the caller wants is the end of the audio
+    int slot = filled % slots;
+    const float *frames;
+    int count = 0;
+    if (limit < 0 || produced < limit) count = source.read(&frames);
+    if (limit >= 0 && count > limit - produced) count = limit - produced;
+    if (count > 0) {
+      produced += count;
+      size_t size = (size_t)count * channels;
+      if (blocks[slot].size() < size) blocks[slot].resize(size);
+      memcpy(&blocks[slot][0], frames, size * sizeof(float));
+    }
+    counts[slot] = count < 0 ? -1 : count;
+
+    head.store(filled + 1);
+    notify();
+    if (count <= 0) return;
+  }
+}
+
+// whether the producer has a free block to fill, or the caller a full one
+// to read
+bool DecodeAheadReader::ready(bool producer)
+{
+  unsigned int filled = head.load(), released = tail.load();
+  if (producer) return filled - released < (unsigned int)slots;
+  return filled != released;
+}
+
+// sleep until the other side moves its index on or the reader stops. a
+// sleeper counts itself before looking at the indices, and the other side
+// looks for sleepers after moving an index, so one of them always sees the
+// other's change
+void DecodeAheadReader::sleep(bool producer)
+{
+  pthread_mutex_lock(&mutex);
+  sleepers++;
+  while (!stopping && !ready(producer))
+    pthread_cond_wait(&wake, &mutex);
+  sleepers--;
+  pthread_mutex_unlock(&mutex);
+}
+
+void DecodeAheadReader::notify()
+{
+  if (sleepers.load() == 0) return;
+  pthread_mutex_lock(&mutex);
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&mutex);
+}
+
+// hand the caller the next decoded block, which stays valid until the next
+// call
+int DecodeAheadReader::read(const float **frames)
+{
+  if (!running && !direct) start();
+  if (direct) return source.read(frames);
+
+  // release the previous block to the producer
+  unsigned int taken = tail.load(std::memory_order_relaxed);
+  if (holding) {
+    tail.store(++taken);
+    holding = false;
+    notify();
+  }
+
+  while (!ready(false)) sleep(false);
+
+  // the end of the audio stays in the queue, so later calls return it too
+  int slot = taken % slots;
+  int count = counts[slot];
+  if (count <= 0) return count;
+  holding = true;
+  *frames = &blocks[slot][0];
+  return count;
+}
+
+// decode no more than the given number of frames from where reading starts
+// or the next seek, so that a caller which only wants part of the audio
+// doesn't leave the producer decoding past it. a negative number decodes
+// everything
+void DecodeAheadReader::setLimit(sf_count_t frames)
+{
+  stop();
+  direct = false;
+  limit = frames;
+}
+
+// throw away what was decoded ahead and start again from another frame
+int DecodeAheadReader::seek(sf_count_t frame)
+{
+  stop();
+  direct = false;
+  return source.seek(frame);
+}
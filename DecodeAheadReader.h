@@ -0,0 +1,71 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef DECODEAHEADREADER_H
+#define DECODEAHEADREADER_H
+
+#include "AudioReader.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <vector>
+
+// number of blocks decoded ahead of the caller unless told otherwise
+#define DECODE_AHEAD_BLOCKS 8
+
+// Reads another reader on a thread of its own, so that decoding (and any
+// resampling) overlaps with whatever the caller does with each block. The
+// blocks pass through a bounded single-producer single-consumer queue of
+// preallocated buffers whose indices are atomic, so neither side takes a
+// lock unless it has to sleep because the queue is full or empty.
+class DecodeAheadReader : public AudioReader
+{
+  protected:
+    AudioReader &source;
+    int slots;
+    std::vector<std::vector<float> > blocks;
+    std::vector<int> counts;          // frames in each block, or 0 at the
+                                      // end of the audio and -1 on error
+    std::atomic<unsigned int> head;   // blocks filled by the producer
+    std::atomic<unsigned int> tail;   // blocks released by the caller
+    std::atomic<int> sleepers;
+    std::atomic<bool> stopping;
+    sf_count_t limit;                 // frames to decode from the start, or
+                                      // -1 to decode to the end
+    sf_count_t produced;
+    bool holding;                     // the caller has the block at tail
+    bool running;
+    bool direct;                      // no thread, so read on the caller's
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    void start();
+    void stop();
+    void produce();
+    bool ready(bool producer);
+    void sleep(bool producer);
+    void notify();
+    static void *worker(void *reader);
+
+  public:
+    DecodeAheadReader(AudioReader &source, int channels,
+                      int slots=DECODE_AHEAD_BLOCKS);
+    virtual ~DecodeAheadReader();
+    virtual int read(const float **frames);
+    virtual int seek(sf_count_t frame);
+    void setLimit(sf_count_t frames);
+};
+
+#endif
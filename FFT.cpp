@@ -0,0 +1,92 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FFT.h"
+
+#include <cmath>
+
+FFT::FFT(int size_in)
+{
+  size = size_in;
+  half = size / 2;
+
+  cosines.resize(half + 1);
+  sines.resize(half + 1);
+  for (int k = 0; k <= half; ++k) {
+    cosines[k] = cos(2 * M_PI * k / size);
+    sines[k] = sin(2 * M_PI * k / size);
+  }
+
+  int bits = 0;
+  while ((1 << bits) < half) ++bits;
+  reversed.resize(half);
+  for (int i = 0; i < half; ++i) {
+    int r = 0;
+    for (int b = 0; b < bits; ++b)
+      if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+    reversed[i] = r;
+  }
+
+  re.resize(half);
+  im.resize(half);
+}
+
+// whether the host's own transform can be used for blocks of this size
+bool FFT::isPowerOfTwo(int size)
+{
+  return size >= 2 && (size & (size - 1)) == 0;
+}
+
+int FFT::getSize()
+{
+  return size;
+}
+
+// transform size real samples into the size/2+1 bins from DC to Nyquist
+void FFT::forward(const double *in, double *outRe, double *outIm)
+{
+  // pack pairs of samples into complex values, in bit-reversed order
+  for (int i = 0; i < half; ++i) {
+    re[reversed[i]] = in[2 * i];
+    im[reversed[i]] = in[2 * i + 1];
+  }
+
+  // radix-2 butterflies; a twiddle of the half-size transform is every
+  // other one of the full size
+  for (int len = 2; len <= half; len <<= 1) {
+    int stride = size / len;
+    for (int i = 0; i < half; i += len) {
+      for (int j = 0; j < len / 2; ++j) {
+        double c = cosines[j * stride], s = sines[j * stride];
+        int a = i + j, b = a + len / 2;
+        double tr = c * re[b] + s * im[b];
+        double ti = c * im[b] - s * re[b];
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+
+  // separate the spectra of the even and odd samples, and combine them
+  for (int k = 0; k <= half; ++k) {
+    int a = k % half, b = (half - k) % half;
+    double evenRe = (re[a] + re[b]) / 2, evenIm = (im[a] - im[b]) / 2;
+    double oddRe = (im[a] + im[b]) / 2, oddIm = (re[b] - re[a]) / 2;
+    outRe[k] = evenRe + cosines[k] * oddRe + sines[k] * oddIm;
+    outIm[k] = evenIm + cosines[k] * oddIm - sines[k] * oddRe;
+  }
+}
@@ -0,0 +1,43 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+
+// A forward transform of real input whose size is a power of two, done as a
+// complex transform of half the size whose output is then separated into the
+// spectra of the even and odd samples and combined. The tables are built
+// once, so one FFT can transform every block of a run.
+class FFT
+{
+  protected:
+    int size;
+    int half;
+    std::vector<int> reversed;     // bit-reversed order of the half-size input
+    std::vector<double> cosines;   // cos(2 pi k / size) for k up to half
+    std::vector<double> sines;
+    std::vector<double> re;
+    std::vector<double> im;
+
+  public:
+    FFT(int size);
+    static bool isPowerOfTwo(int size);
+    int getSize();
+    void forward(const double *in, double *outRe, double *outIm);
+};
+
+#endif
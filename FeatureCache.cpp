@@ -0,0 +1,343 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FeatureCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+
+// identifies cache entries, written in the host's byte order
+#define FEATURE_CACHE_MAGIC 0x43504d56
+#define FEATURE_CACHE_SUFFIX ".vfc"
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t PRIME3 = 0x165667b19e3779f9ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t word)
+{
+  return rotl(acc + word * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t load64(const unsigned char *p)
+{
+  uint64_t word;
+  memcpy(&word, p, 8);
+  return word;
+}
+
+FeatureCache::FeatureCache(string dir_in, off_t maxBytes_in)
+{
+  dir = dir_in;
+  maxBytes = maxBytes_in;
+  mkdir(dir.c_str(), 0777);
+}
+
+// a 64-bit hash in the style of xxHash, which mixes four independent lanes
+// so that it runs at close to memory bandwidth
+uint64_t FeatureCache::hash(const void *data, size_t size, uint64_t seed)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  const unsigned char *end = p + size;
+  uint64_t h;
+
+  if (size >= 32) {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = round64(v1, load64(p));
+      v2 = round64(v2, load64(p + 8));
+      v3 = round64(v3, load64(p + 16));
+      v4 = round64(v4, load64(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+  } else {
+    h = seed + PRIME3;
+  }
+
+  h += size;
+  for (; p + 8 <= end; p += 8)
+    h = rotl(h ^ round64(0, load64(p)), 27) * PRIME1 + PRIME3;
+  for (; p < end; ++p)
+    h = rotl(h ^ (*p * PRIME3), 11) * PRIME1;
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+// hash a block of memory, returning a hex string
+string FeatureCache::hashMemory(const void *data, size_t size)
+{
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx",
+           (unsigned long long)(size > 0 ? hash(data, size) : 0));
+  return hex;
+}
+
+// hash the whole content of a file, returning a hex string or an empty
+// string if the file can't be read
+string FeatureCache::hashFile(string path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return "";
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return "";
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return hashMemory(NULL, 0);
+  }
+
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return "";
+  madvise(addr, st.st_size, MADV_SEQUENTIAL);
+  string h = hashMemory(addr, st.st_size);
+  munmap(addr, st.st_size);
+  return h;
+}
+
+// the file holding an entry, named by two hashes of its key
+string FeatureCache::entryPath(string key)
+{
+  char name[33];
+  snprintf(name, sizeof(name), "%016llx%016llx",
+           (unsigned long long)hash(key.data(), key.size(), 0),
+           (unsigned long long)hash(key.data(), key.size(), PRIME3));
+  return dir + "/" + name + FEATURE_CACHE_SUFFIX;
+}
+
+template <typename T>
+static bool readValue(FILE *f, T *value)
+{
+  return fread(value, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+static void writeValue(FILE *f, T value)
+{
+  fwrite(&value, sizeof(T), 1, f);
+}
+
+// the bytes of a file left to read, which bound any length read from it
+static uint64_t remaining(FILE *f, off_t size)
+{
+  off_t pos = ftello(f);
+  return pos < 0 || pos > size ? 0 : size - pos;
+}
+
+template <typename T>
+static bool readArray(FILE *f, off_t size, std::vector<T> *array)
+{
+  uint64_t length;
+  if (!readValue(f, &length)) return false;
+  if (length > remaining(f, size) / sizeof(T)) return false;
+  array->resize(length);
+  return length == 0 || fread(&(*array)[0], sizeof(T), length, f) == length;
+}
+
+template <typename T>
+static void writeArray(FILE *f, const std::vector<T> &array)
+{
+  writeValue(f, (uint64_t)array.size());
+  if (!array.empty()) fwrite(&array[0], sizeof(T), array.size(), f);
+}
+
+static bool readString(FILE *f, off_t size, string *s)
+{
+  uint32_t length;
+  if (!readValue(f, &length)) return false;
+  if (length > remaining(f, size)) return false;
+  s->resize(length);
+  return length == 0 || fread(&(*s)[0], 1, length, f) == length;
+}
+
+static void writeString(FILE *f, const string &s)
+{
+  writeValue(f, (uint32_t)s.size());
+  fwrite(s.data(), 1, s.size(), f);
+}
+
+// whether the arrays of a table read back from a file agree with each
+// other, so that the rows of every feature lie within its values
+static bool isConsistent(const FeatureTable &table)
+{
+  size_t n = table.size();
+  if (table.sampleRate <= 0 || table.bins < -1) return false;
+  if (!table.durations.empty() && table.durations.size() != n) return false;
+  if (!table.labels.empty() && table.labels.size() != n) return false;
+  if (table.bins >= 0) {
+    return table.bins == 0 ? table.values.empty() :
+      table.values.size() % table.bins == 0 &&
+      table.values.size() / table.bins == n;
+  }
+  if (table.offsets.size() != n + 1 || table.offsets[0] != 0 ||
+      table.offsets[n] != (int64_t)table.values.size())
+    return false;
+  for (size_t i = 0; i < n; ++i)
+    if (table.offsets[i + 1] < table.offsets[i]) return false;
+  return true;
+}
+
+// read the features stored under a key, returning false if there are none.
+// entries may have been cut short or damaged, so every length is checked
+// against what is left of the file before it is allocated
+bool FeatureCache::load(string key, FeatureTable &features)
+{
+  string path = entryPath(key);
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0) {
+    fclose(f);
+    return false;
+  }
+
+  // the stored key guards against hash collisions. each label takes at
+  // least its length
+  uint32_t magic = 0, labels = 0;
+  string storedKey;
+  FeatureTable table;
+  bool ok = readValue(f, &magic) && magic == FEATURE_CACHE_MAGIC &&
+            readString(f, st.st_size, &storedKey) && storedKey == key &&
+            readValue(f, &table.sampleRate) && readValue(f, &table.bins) &&
+            readArray(f, st.st_size, &table.values) &&
+            readArray(f, st.st_size, &table.offsets) &&
+            readArray(f, st.st_size, &table.positions) &&
+            readArray(f, st.st_size, &table.durations) &&
+            readValue(f, &labels) &&
+            labels <= remaining(f, st.st_size) / sizeof(uint32_t);
+  if (ok) table.labels.resize(labels);
+  for (uint32_t i = 0; ok && i < labels; ++i)
+    ok = readString(f, st.st_size, &table.labels[i]);
+  fclose(f);
+  if (!ok || !isConsistent(table)) return false;
+
+  // mark the entry as recently used
+  utimes(path.c_str(), NULL);
+  features = std::move(table);
+  return true;
+}
+
+// open a new file with a unique name next to path, for writing
+static FILE *createTemporary(string path, string *tmp)
+{
+  std::vector<char> name(path.begin(), path.end());
+  const char suffix[] = ".XXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(&name[0]);
+  if (fd < 0) return NULL;
+  fchmod(fd, 0644);
+  *tmp = &name[0];
+  FILE *f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp->c_str());
+  }
+  return f;
+}
+
+// store the features under a key, replacing any already there
+int FeatureCache::store(string key, const FeatureTable &features)
+{
+  // write to a private file which is renamed into place, so that other
+  // processes sharing the directory never see part of an entry
+  string path = entryPath(key);
+  string tmp;
+  FILE *f = createTemporary(path, &tmp);
+  if (!f) {
+    cerr << "WARNING: Could not write to cache directory " << dir << endl;
+    return 1;
+  }
+
+  writeValue(f, (uint32_t)FEATURE_CACHE_MAGIC);
+  writeString(f, key);
+  writeValue(f, features.sampleRate);
+  writeValue(f, features.bins);
+  writeArray(f, features.values);
+  writeArray(f, features.offsets);
+  writeArray(f, features.positions);
+  writeArray(f, features.durations);
+  writeValue(f, (uint32_t)features.labels.size());
+  for (size_t i = 0; i < features.labels.size(); ++i)
+    writeString(f, features.labels[i]);
+
+  bool ok = !ferror(f);
+  if (fclose(f) != 0) ok = false;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    cerr << "WARNING: Could not write to cache directory " << dir << endl;
+    unlink(tmp.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+// delete the least recently used entries until the cache fits its limit
+void FeatureCache::evict()
+{
+  DIR *d = opendir(dir.c_str());
+  if (!d) return;
+
+  std::vector<std::pair<time_t, string> > entries;
+  off_t total = 0;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    string name = e->d_name;
+    size_t suffix = strlen(FEATURE_CACHE_SUFFIX);
+    if (name.size() <= suffix ||
+        name.compare(name.size() - suffix, suffix, FEATURE_CACHE_SUFFIX))
+      continue;
+    string path = dir + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) continue;
+    entries.push_back(std::make_pair(st.st_mtime, path));
+    total += st.st_size;
+  }
+  closedir(d);
+  if (total <= maxBytes) return;
+
+  std::sort(entries.begin(), entries.end());
+  for (size_t i = 0; i < entries.size() && total > maxBytes; ++i) {
+    struct stat st;
+    if (stat(entries[i].second.c_str(), &st) != 0) continue;
+    if (unlink(entries[i].second.c_str()) == 0) total -= st.st_size;
+  }
+}
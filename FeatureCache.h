@@ -0,0 +1,51 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef FEATURECACHE_H
+#define FEATURECACHE_H
+
+#include "FeatureStore.h"
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+using std::string;
+
+// bumped whenever the host changes in a way that alters the features
+#define FEATURE_CACHE_VERSION 2
+
+// Stores the feature tables of Vamp plugin outputs in a directory shared
+// between runs, so that audio which has been analysed before is not
+// analysed again. Entries are looked up by a key string which must capture
+// everything the features depend on, and the least recently used entries
+// are deleted when the directory grows beyond its size limit.
+class FeatureCache
+{
+  protected:
+    string dir;
+    off_t maxBytes;
+    string entryPath(string key);
+
+  public:
+    FeatureCache(string dir, off_t maxBytes);
+    bool load(string key, FeatureTable &features);
+    int store(string key, const FeatureTable &features);
+    void evict();
+    static uint64_t hash(const void *data, size_t size, uint64_t seed=0);
+    static string hashMemory(const void *data, size_t size);
+    static string hashFile(string path);
+};
+
+#endif
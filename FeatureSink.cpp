@@ -0,0 +1,111 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FeatureSink.h"
+
+#include <utility>
+
+void FeatureSink::rows(int output, const float *values, int bins,
+                       size_t count, int64_t position, int64_t step,
+                       int sampleRate)
+{
+  Plugin::FeatureList list(count);
+  for (size_t i = 0; i < count; ++i) {
+    list[i].hasTimestamp = true;
+    list[i].timestamp = Vamp::RealTime::frame2RealTime(position + i * step,
+                                                       sampleRate);
+    list[i].values.assign(values + i * bins, values + (i + 1) * bins);
+  }
+  features(output, list);
+}
+
+// features are positioned by sample frames at sampleRate
+FeatureStoreSink::FeatureStoreSink(FeatureStore &results_in, int sampleRate_in)
+  : results(results_in), sampleRate(sampleRate_in)
+{
+}
+
+// keep the features of an output; if never called, every output is kept
+void FeatureStoreSink::keep(int output)
+{
+  outputs.insert(output);
+}
+
+bool FeatureStoreSink::wants(int output)
+{
+  return outputs.empty() || outputs.count(output);
+}
+
+void FeatureStoreSink::features(int output, Plugin::FeatureList &features)
+{
+  if (!wants(output)) return;
+
+  FeatureTable &table = results[output];
+  table.sampleRate = sampleRate;
+  table.append(features);
+}
+
+// append rows straight to the table, which is at the same rate
+void FeatureStoreSink::rows(int output, const float *values, int bins,
+                            size_t count, int64_t position, int64_t step,
+                            int rate)
+{
+  if (!wants(output)) return;
+  if (rate != sampleRate) {
+    FeatureSink::rows(output, values, bins, count, position, step, rate);
+    return;
+  }
+
+  FeatureTable &table = results[output];
+  table.sampleRate = sampleRate;
+  table.append(values, bins, count, position, step);
+}
+
+// keep features timestamped from start up to end, or to the end of the
+// file if end is zero
+SegmentSink::SegmentSink(FeatureSink &target_in, Vamp::RealTime start_in,
+                         Vamp::RealTime end_in)
+  : target(target_in), start(start_in), end(end_in)
+{
+}
+
+bool SegmentSink::wants(int output)
+{
+  return target.wants(output);
+}
+
+void SegmentSink::features(int output, Plugin::FeatureList &features)
+{
+  if (!wants(output)) return;
+
+  Plugin::FeatureList &list = buffered[output];
+  for (unsigned int i=0; i<features.size(); i++)
+  {
+    Vamp::RealTime time = features[i].timestamp;
+    if (features[i].hasTimestamp &&
+        (time < start || (end != Vamp::RealTime::zeroTime && time >= end)))
+      continue;
+    list.push_back(std::move(features[i]));
+  }
+}
+
+// pass the buffered features on to the target
+void SegmentSink::flush()
+{
+  for (Plugin::FeatureSet::iterator it = buffered.begin();
+       it != buffered.end(); ++it)
+    target.features(it->first, it->second);
+  buffered.clear();
+}
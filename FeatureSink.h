@@ -0,0 +1,83 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef FEATURESINK_H
+#define FEATURESINK_H
+
+#include "FeatureStore.h"
+#include <vamp-hostsdk/Plugin.h>
+#include <set>
+
+using Vamp::Plugin;
+
+// Receives features from a VampHost as soon as the plugin returns them.
+class FeatureSink
+{
+  public:
+    virtual ~FeatureSink() {}
+
+    // whether the features of an output are needed at all
+    virtual bool wants(int output) { return true; }
+
+    // called with each list of features produced for an output; the sink
+    // owns the features for the duration of the call and may move them out
+    virtual void features(int output, Plugin::FeatureList &features) = 0;
+
+    // called by the host's built-in analysers with count rows of bins
+    // values, positioned every step frames from the sample frame position
+    // at sampleRate. by default they are passed to features() as a list
+    virtual void rows(int output, const float *values, int bins,
+                      size_t count, int64_t position, int64_t step,
+                      int sampleRate);
+};
+
+// Appends the features of the selected outputs to the tables of a
+// FeatureStore. Features of any other output are dropped as they arrive.
+class FeatureStoreSink : public FeatureSink
+{
+  protected:
+    FeatureStore &results;
+    int sampleRate;
+    std::set<int> outputs;
+
+  public:
+    FeatureStoreSink(FeatureStore &results, int sampleRate);
+    void keep(int output);
+    virtual bool wants(int output);
+    virtual void features(int output, Plugin::FeatureList &features);
+    virtual void rows(int output, const float *values, int bins,
+                      size_t count, int64_t position, int64_t step,
+                      int sampleRate);
+};
+
+// Buffers the features of one time segment of a file, dropping any which
+// are timestamped outside of it, until flush() passes them on in order.
+class SegmentSink : public FeatureSink
+{
+  protected:
+    FeatureSink &target;
+    Vamp::RealTime start;
+    Vamp::RealTime end;
+    Plugin::FeatureSet buffered;
+
+  public:
+    SegmentSink(FeatureSink &target, Vamp::RealTime start,
+                Vamp::RealTime end);
+    virtual bool wants(int output);
+    virtual void features(int output, Plugin::FeatureList &features);
+    void flush();
+};
+
+#endif
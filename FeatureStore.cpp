@@ -0,0 +1,254 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FeatureStore.h"
+#include "VisPlugin.h"
+#include "SIMD.h"
+#include <algorithm>
+#include <cmath>
+
+using Vamp::RealTime;
+
+FeatureTable::FeatureTable(int sampleRate_in)
+{
+  sampleRate = sampleRate_in;
+  bins = 0;
+}
+
+// the values of feature i
+const float *FeatureTable::row(size_t i) const
+{
+  if (bins >= 0) return values.data() + i * bins;
+  return values.data() + offsets[i];
+}
+
+int FeatureTable::binCount(size_t i) const
+{
+  if (bins >= 0) return bins;
+  return offsets[i + 1] - offsets[i];
+}
+
+void FeatureTable::append(const Plugin::Feature &feature)
+{
+  size_t n = size();
+  int count = feature.values.size();
+
+  // the first feature sets the width of the table, and offsets are only
+  // needed once a feature doesn't match it
+  if (n == 0) bins = count;
+  if (bins >= 0 && count != bins) {
+    offsets.resize(n + 1);
+    for (size_t i = 0; i <= n; ++i) offsets[i] = i * bins;
+    bins = -1;
+  }
+  values.insert(values.end(), feature.values.begin(), feature.values.end());
+  if (bins < 0) offsets.push_back(values.size());
+
+  positions.push_back(RealTime::realTime2Frame(feature.timestamp, sampleRate));
+
+  if (feature.hasDuration) {
+    if (durations.empty()) durations.assign(n, -1);
+    durations.push_back(RealTime::realTime2Frame(feature.duration, sampleRate));
+  } else if (!durations.empty()) {
+    durations.push_back(-1);
+  }
+
+  if (!feature.label.empty()) {
+    if (labels.empty()) labels.resize(n);
+    labels.push_back(feature.label);
+  } else if (!labels.empty()) {
+    labels.push_back("");
+  }
+}
+
+void FeatureTable::append(const Plugin::FeatureList &features)
+{
+  for (unsigned int i = 0; i < features.size(); ++i) append(features[i]);
+}
+
+// append count rows of bins values, positioned every step frames from the
+// given frame
+void FeatureTable::append(const float *data, int bins_in, size_t count,
+                          int64_t position, int64_t step)
+{
+  if (count == 0) return;
+  if (size() == 0) bins = bins_in;
+
+  // rows which don't match the width of the table go the long way round
+  if (bins != bins_in) {
+    for (size_t i = 0; i < count; ++i) {
+      Plugin::Feature feature;
+      feature.hasTimestamp = true;
+      feature.timestamp = RealTime::frame2RealTime(position + i * step,
+                                                   sampleRate);
+      feature.values.assign(data + i * bins_in, data + (i + 1) * bins_in);
+      append(feature);
+    }
+    return;
+  }
+
+  values.insert(values.end(), data, data + count * bins);
+  for (size_t i = 0; i < count; ++i)
+    positions.push_back(position + i * step);
+  if (!durations.empty()) durations.resize(size(), -1);
+  if (!labels.empty()) labels.resize(size());
+}
+
+// the running minimum, maximum, sum and sum of squares of each bin
+struct BinStats
+{
+  std::vector<float> lo, hi, sum, squares;
+
+  // start from the values of one row
+  void reset(const float *values, int bins) {
+    lo.assign(values, values + bins);
+    hi.assign(values, values + bins);
+    sum.assign(values, values + bins);
+    squares.resize(bins);
+    for (int b = 0; b < bins; ++b) squares[b] = values[b] * values[b];
+  }
+
+  void add(int b, float value) {
+    lo[b] = std::min(lo[b], value);
+    hi[b] = std::max(hi[b], value);
+    sum[b] += value;
+    squares[b] += value * value;
+  }
+};
+
+// add rows of values to the stats of their bins
+static void accumulate(BinStats &stats, const float *values, size_t rows,
+                       int bins)
+{
+  size_t count = rows * bins;
+  size_t i = 0;
+
+  if (bins == 1 || bins == 2 || bins == 4) {
+    // the rows are contiguous, and each lane holds the same bin throughout,
+    // so the rows are read four values at a time and the lanes of each bin
+    // combined at the end
+    if (count >= 4) {
+      const float zero[4] = {0, 0, 0, 0};
+      float4 lo = load4(values), hi = lo, sum = lo;
+      float4 squares = addSquare4(load4(zero), lo);
+      for (i = 4; i + 4 <= count; i += 4) {
+        float4 v = load4(values + i);
+        lo = min4(lo, v);
+        hi = max4(hi, v);
+        sum = add4(sum, v);
+        squares = addSquare4(squares, v);
+      }
+      float part[4][4];
+      store4(part[0], lo);
+      store4(part[1], hi);
+      store4(part[2], sum);
+      store4(part[3], squares);
+      for (int k = 0; k < 4; ++k) {
+        int b = k % bins;
+        stats.lo[b] = std::min(stats.lo[b], part[0][k]);
+        stats.hi[b] = std::max(stats.hi[b], part[1][k]);
+        stats.sum[b] += part[2][k];
+        stats.squares[b] += part[3][k];
+      }
+    }
+    for (; i < count; ++i) stats.add(i % bins, values[i]);
+    return;
+  }
+
+  // otherwise run along each row four bins at a time
+  for (size_t r = 0; r < rows; ++r) {
+    const float *row = values + r * bins;
+    int b = 0;
+    for (; b + 4 <= bins; b += 4) {
+      float4 v = load4(row + b);
+      store4(&stats.lo[b], min4(load4(&stats.lo[b]), v));
+      store4(&stats.hi[b], max4(load4(&stats.hi[b]), v));
+      store4(&stats.sum[b], add4(load4(&stats.sum[b]), v));
+      store4(&stats.squares[b], addSquare4(load4(&stats.squares[b]), v));
+    }
+    for (; b < bins; ++b) stats.add(b, row[b]);
+  }
+}
+
+// the features positioned from start up to end seconds, or to the end of
+// the table if end is 0
+void FeatureTable::range(double start, double end, size_t *first,
+                         size_t *last) const
+{
+  *first = std::lower_bound(positions.begin(), positions.end(),
+                            llround(start * sampleRate)) - positions.begin();
+  *last = size();
+  if (end > 0) {
+    *last = std::lower_bound(positions.begin() + *first, positions.end(),
+                             llround(end * sampleRate)) - positions.begin();
+  }
+}
+
+// reduce features first to last to the given number of rows, each of which
+// combines an equal share of them in the way given by one of the REDUCE_
+// modes. returns false, leaving out untouched, if there is nothing to
+// reduce or the features vary in size
+bool FeatureTable::reduce(int rows, int mode, FeatureTable &out,
+                          size_t first, size_t last) const
+{
+  size_t n = last - first;
+  if (mode == REDUCE_NONE || rows < 1 || n <= (size_t)rows || bins < 1)
+    return false;
+
+  int outBins = (mode == REDUCE_MINMAX) ? 2 * bins : bins;
+  out.sampleRate = sampleRate;
+  out.bins = outBins;
+  out.values.resize((size_t)rows * outBins);
+  out.offsets.clear();
+  out.positions.resize(rows);
+  out.durations.clear();
+  if (!durations.empty()) out.durations.resize(rows);
+  out.labels.clear();
+
+  BinStats stats;
+  for (int r = 0; r < rows; ++r)
+  {
+    size_t from = first + n * r / rows;
+    size_t to = first + n * (r + 1) / rows;
+    const float *values = row(from);
+    stats.reset(values, bins);
+    accumulate(stats, values + bins, to - from - 1, bins);
+
+    float *dest = out.values.data() + (size_t)r * outBins;
+    float scale = 1.0f / (to - from);
+    for (int b = 0; b < bins; ++b) {
+      switch (mode) {
+        case REDUCE_MIN: dest[b] = stats.lo[b]; break;
+        case REDUCE_MAX: dest[b] = stats.hi[b]; break;
+        case REDUCE_MEAN: dest[b] = stats.sum[b] * scale; break;
+        case REDUCE_RMS: dest[b] = sqrtf(stats.squares[b] * scale); break;
+        case REDUCE_MINMAX:
+          dest[b] = stats.lo[b];
+          dest[bins + b] = stats.hi[b];
+          break;
+      }
+    }
+
+    // each row spans the features it combines
+    out.positions[r] = positions[from];
+    if (!durations.empty()) {
+      int64_t end = positions[to - 1] + std::max(durations[to - 1],
+                                                 (int64_t)0);
+      out.durations[r] = end - positions[from];
+    }
+  }
+
+  return true;
+}
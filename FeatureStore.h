@@ -0,0 +1,78 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef FEATURESTORE_H
+#define FEATURESTORE_H
+
+#include <vamp-hostsdk/Plugin.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using Vamp::Plugin;
+
+// The features of one Vamp plugin output held in flat arrays, rather than
+// as a list of features which each allocate their own values and label.
+// Feature i has binCount(i) values starting at row(i), and is positioned at
+// a sample frame at the table's sample rate.
+class FeatureTable
+{
+  public:
+    int sampleRate;                  // of positions and durations
+    int bins;                        // values per feature, or -1 if they vary
+    std::vector<float> values;       // the values of each feature in turn
+    std::vector<int64_t> offsets;    // start of each feature's values and the
+                                     // end of the last, only if bins vary
+    std::vector<int64_t> positions;  // sample frame of each feature
+    std::vector<int64_t> durations;  // frames, or -1 for none; empty if no
+                                     // feature has a duration
+    std::vector<std::string> labels; // empty if no feature has a label
+
+    FeatureTable(int sampleRate=0);
+    size_t size() const { return positions.size(); }
+    const float *row(size_t i) const;
+    int binCount(size_t i) const;
+    void append(const Plugin::Feature &feature);
+    void append(const Plugin::FeatureList &features);
+    void append(const float *data, int bins, size_t count,
+                int64_t position, int64_t step);
+    void range(double start, double end, size_t *first, size_t *last) const;
+    bool reduce(int rows, int mode, FeatureTable &out, size_t first,
+                size_t last) const;
+};
+
+// The tables of a set of outputs, by output number.
+class FeatureStore
+{
+  protected:
+    std::map<int, FeatureTable> tables;
+
+  public:
+    typedef std::map<int, FeatureTable>::iterator iterator;
+    typedef std::map<int, FeatureTable>::const_iterator const_iterator;
+
+    FeatureTable &operator[](int output) { return tables[output]; }
+    const FeatureTable &operator[](int output) const
+      { return tables.find(output)->second; }
+    size_t count(int output) const { return tables.count(output); }
+    iterator begin() { return tables.begin(); }
+    iterator end() { return tables.end(); }
+    const_iterator begin() const { return tables.begin(); }
+    const_iterator end() const { return tables.end(); }
+    void clear() { tables.clear(); }
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "ImageWriter.h"
+#include "PNGWriter.h"
+#include "QOIWriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <sstream>
+#include <unistd.h>
+
+// bytes of converted rows written at a time
+#define PNM_BATCH_SIZE (64 * 1024)
+
+ImageWriter::ImageWriter(int width_in, int height_in, unsigned char *buffer)
+{
+  width = width_in;
+  height = height_in;
+  image = buffer;
+}
+
+// the writer for an image format, or NULL if it isn't known
+ImageWriter *ImageWriter::create(int format, int width, int height,
+                                 unsigned char *buffer,
+                                 const PNGOptions &options)
+{
+  switch (format) {
+    case IMAGE_PNG: return new PNGWriter(width, height, buffer, options);
+    case IMAGE_RAW: return new RawWriter(width, height, buffer);
+    case IMAGE_PPM: return new PNMWriter(width, height, buffer, false);
+    case IMAGE_PAM: return new PNMWriter(width, height, buffer, true);
+    case IMAGE_QOI: return new QOIWriter(width, height, buffer);
+  }
+  return NULL;
+}
+
+// the format of the given name, or -1 if it isn't known
+int ImageWriter::parseFormat(const std::string &name)
+{
+  if (name == "png") return IMAGE_PNG;
+  if (name == "raw" || name == "argb") return IMAGE_RAW;
+  if (name == "ppm") return IMAGE_PPM;
+  if (name == "pam") return IMAGE_PAM;
+  if (name == "qoi") return IMAGE_QOI;
+  return -1;
+}
+
+// the format implied by the extension of a file name, which is PNG unless
+// it says otherwise
+int ImageWriter::formatOf(const std::string &filename)
+{
+  std::string::size_type dot = filename.rfind('.');
+  if (dot == std::string::npos || filename.find('/', dot) !=
+      std::string::npos)
+    return IMAGE_PNG;
+  int format = parseFormat(filename.substr(dot + 1));
+  return format < 0 ? IMAGE_PNG : format;
+}
+
+// write a file, or standard output if the file name is "-"
+int ImageWriter::write(const char* filename)
+{
+  if (std::string(filename) == "-") {
+    int status = write(stdout);
+    if (fflush(stdout) != 0) status = 1;
+    return status;
+  }
+
+  // open file for writing
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    cerr << "Could not open file to write image." << endl;
+    return 1;
+  }
+
+  int status = write(fp);
+  if (fclose(fp) != 0) status = 1;
+  return status;
+}
+
+// write the image to an open stream, such as a pipe or socket
+int ImageWriter::write(FILE *fp)
+{
+  return encode(fp, NULL);
+}
+
+// append the encoded image to a block of memory
+int ImageWriter::write(vector<unsigned char> &bytes)
+{
+  return encode(NULL, &bytes);
+}
+
+// write blocks of memory to a file descriptor in as few calls as possible,
+// without copying them together first
+bool ImageWriter::writeAll(int fd, struct iovec *iov, int count)
+{
+  while (count > 0) {
+    ssize_t n = writev(fd, iov, std::min(count, IOV_MAX));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+
+    // skip past whatever was written
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+// whether every pixel's alpha is 255
+bool ImageWriter::isOpaque() const
+{
+  size_t pixels = (size_t)width * height;
+  for (size_t i = 0; i < pixels; ++i)
+    if (image[i * BYTES_PER_PIXEL + 3] != 255) return false;
+  return true;
+}
+
+// append to memory, or write to a stream
+bool ImageWriter::writeBytes(FILE *fp, vector<unsigned char> *bytes,
+                             const void *data, size_t length)
+{
+  if (bytes) {
+    const unsigned char *p = (const unsigned char*)data;
+    bytes->insert(bytes->end(), p, p + length);
+    return true;
+  }
+  return fwrite(data, 1, length, fp) == length;
+}
+
+RawWriter::RawWriter(int width, int height, unsigned char *buffer)
+  : ImageWriter(width, height, buffer)
+{
+}
+
+// hand the buffer straight to the stream's file descriptor
+int RawWriter::encode(FILE *fp, vector<unsigned char> *bytes)
+{
+  size_t length = (size_t)width * height * BYTES_PER_PIXEL;
+  if (bytes) {
+    writeBytes(fp, bytes, image, length);
+    return 0;
+  }
+
+  struct iovec iov;
+  iov.iov_base = image;
+  iov.iov_len = length;
+  if (fflush(fp) != 0 || !writeAll(fileno(fp), &iov, 1)) {
+    cerr << "Could not write image." << endl;
+    return 1;
+  }
+  return 0;
+}
+
+PNMWriter::PNMWriter(int width, int height, unsigned char *buffer,
+                     bool pam_in)
+  : ImageWriter(width, height, buffer), pam(pam_in)
+{
+}
+
+int PNMWriter::encode(FILE *fp, vector<unsigned char> *bytes)
+{
+  // PPM has no alpha, so PAM is only used when it's needed
+  int depth = pam && !isOpaque() ? 4 : 3;
+  std::ostringstream header;
+  if (pam) {
+    header << "P7\nWIDTH " << width << "\nHEIGHT " << height
+      << "\nDEPTH " << depth << "\nMAXVAL 255\nTUPLTYPE "
+      << (depth == 4 ? "RGB_ALPHA" : "RGB") << "\nENDHDR\n";
+  } else {
+    header << "P6\n" << width << " " << height << "\n255\n";
+  }
+  bool ok = writeBytes(fp, bytes, header.str().data(), header.str().size());
+
+  // convert a batch of rows at a time
+  size_t rowBytes = (size_t)width * depth;
+  int batch = std::max(1, (int)(PNM_BATCH_SIZE / rowBytes));
+  vector<unsigned char> rows(batch * rowBytes);
+  for (int y = 0; ok && y < height; y += batch) {
+    int count = std::min(batch, height - y);
+    const unsigned char *in = image + (size_t)y * width * BYTES_PER_PIXEL;
+    unsigned char *out = &rows[0];
+    for (size_t i = 0; i < (size_t)count * width; ++i, in += 4) {
+      *out++ = in[2];
+      *out++ = in[1];
+      *out++ = in[0];
+      if (depth == 4) *out++ = in[3];
+    }
+    ok = writeBytes(fp, bytes, &rows[0], count * rowBytes);
+  }
+
+  if (!ok) cerr << "Could not write image." << endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+#define BYTES_PER_PIXEL 4
+
+// the largest render buffer requests from other processes may ask for, at
+// 1GB, which also keeps width * height * BYTES_PER_PIXEL well within a
+// size_t
+#define MAX_IMAGE_BYTES ((size_t)1 << 30)
+
+// formats an image can be written in, IMAGE_AUTO going by the extension of
+// the file name
+#define IMAGE_AUTO -1
+#define IMAGE_PNG 0
+#define IMAGE_RAW 1     // the render buffer as it is: native-endian ARGB
+#define IMAGE_PPM 2     // binary PPM, without alpha
+#define IMAGE_PAM 3     // PAM, RGB or RGB_ALPHA as the image needs
+#define IMAGE_QOI 4
+
+struct PNGOptions;
+
+// Writes a rendered image of native-endian ARGB pixels to a file, a stream
+// or memory, in a format chosen by the subclass.
+class ImageWriter
+{
+  public:
+    ImageWriter(int width, int height, unsigned char *buffer);
+    virtual ~ImageWriter() {}
+    int write(const char *filename);
+    int write(FILE *file);
+    int write(vector<unsigned char> &bytes);
+
+    static ImageWriter *create(int format, int width, int height,
+                               unsigned char *buffer,
+                               const PNGOptions &options);
+    static int parseFormat(const std::string &name);
+    static int formatOf(const std::string &filename);
+    static bool writeAll(int fd, struct iovec *iov, int count);
+    static bool writeBytes(FILE *file, vector<unsigned char> *bytes,
+                           const void *data, size_t length);
+
+  protected:
+    int width;
+    int height;
+    unsigned char *image;
+    bool isOpaque() const;
+    virtual int encode(FILE *file, vector<unsigned char> *bytes) = 0;
+};
+
+// Writes the render buffer untouched, straight from memory to the file
+// descriptor of a stream.
+class RawWriter : public ImageWriter
+{
+  public:
+    RawWriter(int width, int height, unsigned char *buffer);
+  protected:
+    virtual int encode(FILE *file, vector<unsigned char> *bytes);
+};
+
+// Writes binary PPM, or PAM with an alpha channel if the image isn't
+// opaque.
+class PNMWriter : public ImageWriter
+{
+  public:
+    PNMWriter(int width, int height, unsigned char *buffer, bool pam);
+  protected:
+    bool pam;
+    virtual int encode(FILE *file, vector<unsigned char> *bytes);
+};
+
+#endif
@@ -14,34 +14,91 @@
    limitations under the License.
 */
 #include "PNGWriter.h"
+#include "ThreadPool.h"
 
-PNGWriter::PNGWriter(int width_in, int height_in, unsigned char *buffer)
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <zlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// the deflate window, which each slice is primed with from the one before
+#define WINDOW_SIZE 32768
+
+PNGWriter::PNGWriter(int width, int height, unsigned char *buffer,
+                     const PNGOptions &options_in)
+  : ImageWriter(width, height, buffer)
 {
-  width = width_in;
-  height = height_in;
-  image = buffer;
+  options = options_in;
+  colorType = PNG_COLOR_TYPE_RGB_ALPHA;
+  pixelBytes = 4;
 }
 
-int PNGWriter::write(const char* filename)
+// turn a comma-separated list of filter names into a mask of PNG filters,
+// or return -1 if one of them isn't known
+int PNGWriter::parseFilters(const std::string &names)
 {
-  // convert 2d array into array of pointers
-  unsigned char* row_pointers[height];
-  for (int i=0; i<height; i++)
-    row_pointers[i] = &image[i*width*BYTES_PER_PIXEL];
-
-  // open file for writing
-  FILE *fp = fopen(filename, "wb");
-  if (!fp) {
-    cerr << "Could not open file to write PNG." << endl;
-    return 1;
+  std::istringstream ss(names);
+  std::string name;
+  int filters = 0;
+  while (std::getline(ss, name, ',')) {
+    if (name == "none") filters |= PNG_FILTER_NONE;
+    else if (name == "sub") filters |= PNG_FILTER_SUB;
+    else if (name == "up") filters |= PNG_FILTER_UP;
+    else if (name == "avg") filters |= PNG_FILTER_AVG;
+    else if (name == "paeth") filters |= PNG_FILTER_PAETH;
+    else if (name == "all") filters |= PNG_ALL_FILTERS;
+    else return -1;
   }
+  return filters ? filters : -1;
+}
+
+// turn the name of a zlib strategy into its value, or return -1 if it
+// isn't known
+int PNGWriter::parseStrategy(const std::string &name)
+{
+  if (name == "default") return Z_DEFAULT_STRATEGY;
+  if (name == "filtered") return Z_FILTERED;
+  if (name == "huffman") return Z_HUFFMAN_ONLY;
+  if (name == "rle") return Z_RLE;
+  if (name == "fixed") return Z_FIXED;
+  return -1;
+}
+
+static void appendBytes(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+  vector<unsigned char> *bytes =
+    (vector<unsigned char>*)png_get_io_ptr(png_ptr);
+  bytes->insert(bytes->end(), data, data + length);
+}
+
+static void flushBytes(png_structp)
+{
+}
+
+int PNGWriter::encode(FILE *fp, vector<unsigned char> *bytes)
+{
+  chooseFormat();
+
+  // split the image between threads if there's enough of it
+  size_t rowBytes = 1 + (size_t)width * pixelBytes;
+  if (options.threads > 1 && (size_t)height * rowBytes > PNG_SLICE_SIZE)
+    return encodeParallel(fp, bytes);
+
+  // each row is converted as it is written
+  vector<unsigned char> row((size_t)width * pixelBytes);
 
   // set up PNG struct
   png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
                                                 NULL, NULL, NULL);
   if (!png_ptr) {
     cerr << "Could not allocate PNG write struct." << endl;
-    fclose(fp);
     return 1;
   }
 
@@ -49,25 +106,497 @@ int PNGWriter::write(const char* filename)
   png_infop info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
     cerr << "Could not allocate PNG info struct." << endl;
-    fclose(fp);
+    png_destroy_write_struct(&png_ptr, NULL);
+    return 1;
+  }
+
+  // libpng jumps back here if writing fails
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    cerr << "Could not write PNG." << endl;
+    png_destroy_write_struct(&png_ptr, &info_ptr);
     return 1;
   }
 
   // initialise PNG writing
-  png_init_io(png_ptr, fp);
+  if (fp) png_init_io(png_ptr, fp);
+  else png_set_write_fn(png_ptr, bytes, appendBytes, flushBytes);
+
+  // set up compression
+  if (options.level >= 0) png_set_compression_level(png_ptr, options.level);
+  if (options.filters >= 0) png_set_filter(png_ptr, 0, options.filters);
+  if (options.strategy >= 0)
+    png_set_compression_strategy(png_ptr, options.strategy);
 
   // write header
   png_set_IHDR(png_ptr, info_ptr, width, height,
-      8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+      8, colorType, PNG_INTERLACE_NONE,
       PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  if (colorType == PNG_COLOR_TYPE_PALETTE) {
+    png_set_PLTE(png_ptr, info_ptr, &palette[0], palette.size());
+    if (!trans.empty())
+      png_set_tRNS(png_ptr, info_ptr, &trans[0], trans.size(), NULL);
+  }
+  png_write_info(png_ptr, info_ptr);
 
   // write image
-  png_set_rows(png_ptr, info_ptr, row_pointers);
-  png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_BGR, NULL);
+  for (int y=0; y<height; y++) {
+    convertRow(y, &row[0]);
+    png_write_row(png_ptr, &row[0]);
+  }
+  png_write_end(png_ptr, info_ptr);
 
   // clean up
   png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(fp);
 
   return 0;
 }
+
+// add a colour to the palette unless it is already there, returning false
+// once there are too many colours for a palette
+bool PNGWriter::addColour(uint32_t colour)
+{
+  uint32_t slot = (colour * 2654435761u) % PNG_COLOUR_SLOTS;
+  while (slotIndices[slot] >= 0) {
+    if (slotColours[slot] == colour) return true;
+    slot = (slot + 1) % PNG_COLOUR_SLOTS;
+  }
+  if (palette.size() == 256) return false;
+
+  slotColours[slot] = colour;
+  slotIndices[slot] = palette.size();
+  unsigned char bgra[4];
+  memcpy(bgra, &colour, 4);
+  png_color entry = { bgra[2], bgra[1], bgra[0] };
+  palette.push_back(entry);
+  trans.push_back(bgra[3]);
+  return true;
+}
+
+// the palette index of a colour in the image
+int PNGWriter::findColour(uint32_t colour) const
+{
+  uint32_t slot = (colour * 2654435761u) % PNG_COLOUR_SLOTS;
+  while (slotColours[slot] != colour)
+    slot = (slot + 1) % PNG_COLOUR_SLOTS;
+  return slotIndices[slot];
+}
+
+// scan the image once for the smallest format which holds it exactly:
+// grey if every pixel is grey and opaque, a palette if there are no more
+// than 256 colours, grey with alpha, RGB if every pixel is opaque, or else
+// RGBA
+void PNGWriter::chooseFormat()
+{
+  colorType = PNG_COLOR_TYPE_RGB_ALPHA;
+  pixelBytes = 4;
+  palette.clear();
+  trans.clear();
+  if (options.rgba) return;
+
+  slotColours.assign(PNG_COLOUR_SLOTS, 0);
+  slotIndices.assign(PNG_COLOUR_SLOTS, -1);
+  bool opaque = true, grey = true, fits = true;
+
+  // test four pixels at a time for any alpha below 255, or any blue,
+  // green or red which differs from the others
+#if defined(__SSE2__)
+  __m128i alpha = _mm_set1_epi32(0xff000000);
+  __m128i colour = _mm_set1_epi32(0x0000ffff);
+  __m128i notOpaque = _mm_setzero_si128(), notGrey = _mm_setzero_si128();
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  uint8x16_t notOpaque = vdupq_n_u8(0), notGrey = vdupq_n_u8(0);
+#endif
+
+  // one row at a time, so that the palette is gathered while the row is
+  // still in the cache, giving up once nothing smaller than RGBA is left
+  for (int y = 0; y < height && (opaque || grey || fits); y++) {
+    const unsigned char *row = image + (size_t)y * width * BYTES_PER_PIXEL;
+    int x = 0;
+#if defined(__SSE2__)
+    for (; x + 4 <= width; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(row + x * 4));
+      notOpaque = _mm_or_si128(notOpaque, _mm_andnot_si128(v, alpha));
+      notGrey = _mm_or_si128(notGrey, _mm_and_si128(colour,
+        _mm_xor_si128(v, _mm_srli_epi32(v, 8))));
+    }
+    opaque = opaque && _mm_movemask_epi8(_mm_cmpeq_epi8(notOpaque,
+      _mm_setzero_si128())) == 0xffff;
+    grey = grey && _mm_movemask_epi8(_mm_cmpeq_epi8(notGrey,
+      _mm_setzero_si128())) == 0xffff;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; x + 16 <= width; x += 16) {
+      uint8x16x4_t v = vld4q_u8(row + x * 4);
+      notOpaque = vorrq_u8(notOpaque, vmvnq_u8(v.val[3]));
+      notGrey = vorrq_u8(notGrey, vorrq_u8(veorq_u8(v.val[0], v.val[1]),
+                                           veorq_u8(v.val[1], v.val[2])));
+    }
+    opaque = opaque && vmaxvq_u8(notOpaque) == 0;
+    grey = grey && vmaxvq_u8(notGrey) == 0;
+#endif
+    for (; x < width; x++) {
+      const unsigned char *p = row + x * 4;
+      if (p[3] != 255) opaque = false;
+      if (p[0] != p[1] || p[1] != p[2]) grey = false;
+    }
+
+    // most images are drawn in runs of the same colour
+    if (fits) {
+      uint32_t last = 0;
+      for (x = 0; x < width && fits; x++) {
+        uint32_t c;
+        memcpy(&c, row + x * 4, 4);
+        if (x > 0 && c == last) continue;
+        fits = addColour(c);
+        last = c;
+      }
+    }
+  }
+
+  if (grey && opaque) {
+    colorType = PNG_COLOR_TYPE_GRAY;
+    pixelBytes = 1;
+  } else if (fits) {
+    colorType = PNG_COLOR_TYPE_PALETTE;
+    pixelBytes = 1;
+
+    // only the entries up to the last transparent one need an alpha
+    while (!trans.empty() && trans.back() == 255) trans.pop_back();
+  } else if (grey) {
+    colorType = PNG_COLOR_TYPE_GRAY_ALPHA;
+    pixelBytes = 2;
+  } else if (opaque) {
+    colorType = PNG_COLOR_TYPE_RGB;
+    pixelBytes = 3;
+  }
+}
+
+// convert a row of the image's native-endian ARGB pixels to the chosen
+// format
+void PNGWriter::convertRow(int y, unsigned char *out) const
+{
+  const unsigned char *in = image + (size_t)y * width * BYTES_PER_PIXEL;
+  int x = 0;
+  switch (colorType) {
+    case PNG_COLOR_TYPE_GRAY:
+      for (; x < width; ++x, in += 4) *out++ = in[0];
+      break;
+    case PNG_COLOR_TYPE_GRAY_ALPHA:
+      for (; x < width; ++x, in += 4) {
+        *out++ = in[0];
+        *out++ = in[3];
+      }
+      break;
+    case PNG_COLOR_TYPE_PALETTE: {
+      uint32_t last = 0;
+      int index = 0;
+      for (; x < width; ++x, in += 4) {
+        uint32_t c;
+        memcpy(&c, in, 4);
+        if (x == 0 || c != last) index = findColour(c);
+        last = c;
+        *out++ = index;
+      }
+      break;
+    }
+    case PNG_COLOR_TYPE_RGB:
+      for (; x < width; ++x, in += 4) {
+        *out++ = in[2];
+        *out++ = in[1];
+        *out++ = in[0];
+      }
+      break;
+    default:
+      for (; x < width; ++x, in += 4) {
+        *out++ = in[2];
+        *out++ = in[1];
+        *out++ = in[0];
+        *out++ = in[3];
+      }
+      break;
+  }
+}
+
+static inline unsigned char paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+// filter a row of pixels of bpp bytes with one PNG filter type, writing
+// the type and then the filtered bytes
+static void filterRow(int type, const unsigned char *row,
+                      const unsigned char *prev, size_t length, size_t bpp,
+                      unsigned char *out)
+{
+  *out++ = type;
+  size_t i = 0;
+  switch (type) {
+    case 0:
+      std::copy(row, row + length, out);
+      break;
+    case 1:
+      for (; i < bpp; ++i) out[i] = row[i];
+      for (; i < length; ++i) out[i] = row[i] - row[i - bpp];
+      break;
+    case 2:
+      for (; i < length; ++i) out[i] = row[i] - prev[i];
+      break;
+    case 3:
+      for (; i < bpp; ++i) out[i] = row[i] - (prev[i] >> 1);
+      for (; i < length; ++i)
+        out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+      break;
+    default:
+      for (; i < bpp; ++i) out[i] = row[i] - prev[i];
+      for (; i < length; ++i)
+        out[i] = row[i] - paeth(row[i - bpp], prev[i], prev[i - bpp]);
+      break;
+  }
+}
+
+// filter a row with whichever of the allowed filters gives the smallest sum
+// of absolute differences, as libpng does
+static void filterBest(int filters, const unsigned char *row,
+                       const unsigned char *prev, size_t length, size_t bpp,
+                       unsigned char *out, unsigned char *scratch)
+{
+  static const int masks[5] = { PNG_FILTER_NONE, PNG_FILTER_SUB,
+    PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH };
+  unsigned long best = (unsigned long)-1;
+  for (int type = 0; type < 5; ++type) {
+    if (!(filters & masks[type])) continue;
+    if (filters == masks[type]) {
+      filterRow(type, row, prev, length, bpp, out);
+      return;
+    }
+    filterRow(type, row, prev, length, bpp, scratch);
+    unsigned long sum = 0;
+    for (size_t i = 1; i <= length && sum < best; ++i)
+      sum += abs((signed char)scratch[i]);
+    if (sum < best) {
+      best = sum;
+      std::copy(scratch, scratch + length + 1, out);
+    }
+  }
+}
+
+// filters a band of rows of the image into the filtered image data
+class FilterTask : public ThreadPool::Task
+{
+  public:
+    const PNGWriter *writer;
+    int first;
+    int last;
+    int filters;
+    unsigned char *filtered;
+
+    FilterTask(const PNGWriter *writer_in, int first_in, int last_in,
+               int filters_in, unsigned char *filtered_in)
+      : writer(writer_in), first(first_in), last(last_in),
+        filters(filters_in), filtered(filtered_in) {}
+
+    void run() {
+      size_t bpp = writer->pixelBytes;
+      size_t pixelBytes = (size_t)writer->width * bpp;
+      size_t rowBytes = 1 + pixelBytes;
+      vector<unsigned char> prev(pixelBytes, 0), row(pixelBytes);
+      vector<unsigned char> scratch(rowBytes);
+      if (first > 0) writer->convertRow(first - 1, &prev[0]);
+      for (int y = first; y < last; ++y) {
+        writer->convertRow(y, &row[0]);
+        filterBest(filters, &row[0], &prev[0], pixelBytes, bpp,
+                   filtered + y * rowBytes, &scratch[0]);
+        prev.swap(row);
+      }
+    }
+};
+
+// deflates one slice of the filtered image data, primed with the data
+// before it and ending on a byte boundary, so that the slices can be joined
+// into one zlib stream as pigz does
+class DeflateTask : public ThreadPool::Task
+{
+  public:
+    const unsigned char *data;
+    size_t length;
+    size_t window;
+    bool final;
+    int level;
+    int strategy;
+    vector<unsigned char> out;
+    uLong adler;
+    int status;
+
+    DeflateTask(const unsigned char *data_in, size_t length_in,
+                size_t window_in, bool final_in, int level_in,
+                int strategy_in)
+      : data(data_in), length(length_in), window(window_in),
+        final(final_in), level(level_in), strategy(strategy_in), adler(0),
+        status(0) {}
+
+    void run() {
+      adler = adler32(adler32(0L, Z_NULL, 0), data, length);
+
+      // raw deflate, without a zlib header or trailer
+      z_stream z;
+      z.zalloc = Z_NULL;
+      z.zfree = Z_NULL;
+      z.opaque = Z_NULL;
+      if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+        status = 1;
+        return;
+      }
+      if (window > 0 &&
+          deflateSetDictionary(&z, data - window, window) != Z_OK) {
+        deflateEnd(&z);
+        status = 1;
+        return;
+      }
+
+      int flush = final ? Z_FINISH : Z_SYNC_FLUSH;
+      out.resize(deflateBound(&z, length) + 16);
+      z.next_in = (Bytef*)data;
+      z.avail_in = length;
+      z.next_out = &out[0];
+      z.avail_out = out.size();
+      int ret = deflate(&z, flush);
+      while (ret == Z_OK && (z.avail_in > 0 || z.avail_out == 0 || final)) {
+        size_t used = out.size();
+        out.resize(used * 2);
+        z.next_out = &out[used];
+        z.avail_out = out.size() - used;
+        ret = deflate(&z, flush);
+      }
+      if (ret != (final ? Z_STREAM_END : Z_OK)) status = 1;
+      out.resize(z.total_out);
+      deflateEnd(&z);
+    }
+};
+
+static void put32(unsigned char *p, uLong value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+// write a PNG chunk of the given type
+static bool writeChunk(FILE *fp, vector<unsigned char> *bytes,
+                       const char *type, const unsigned char *data,
+                       size_t length)
+{
+  unsigned char head[8], tail[4];
+  put32(head, length);
+  std::copy(type, type + 4, head + 4);
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, head + 4, 4);
+  if (length > 0) crc = crc32(crc, data, length);
+  put32(tail, crc);
+  return ImageWriter::writeBytes(fp, bytes, head, 8) &&
+    (length == 0 || ImageWriter::writeBytes(fp, bytes, data, length)) &&
+    ImageWriter::writeBytes(fp, bytes, tail, 4);
+}
+
+// write the PNG with the image filtered and deflated on several threads,
+// each slice of the deflate stream in its own IDAT chunk
+int PNGWriter::encodeParallel(FILE *fp, vector<unsigned char> *bytes)
+{
+  // libpng's defaults, which don't filter palette images
+  int level = options.level >= 0 ? options.level : Z_DEFAULT_COMPRESSION;
+  int filters = options.filters;
+  if (filters < 0) filters = colorType == PNG_COLOR_TYPE_PALETTE ?
+    PNG_FILTER_NONE : PNG_ALL_FILTERS;
+  if (!(filters & PNG_ALL_FILTERS)) filters = PNG_FILTER_NONE;
+  int strategy = options.strategy;
+  if (strategy < 0)
+    strategy = filters == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+
+  // filter bands of rows in parallel
+  size_t rowBytes = 1 + (size_t)width * pixelBytes;
+  size_t total = (size_t)height * rowBytes;
+  vector<unsigned char> filtered(total);
+  ThreadPool pool(options.threads);
+  int bands = std::min(height, options.threads * 4);
+  vector<FilterTask*> filterTasks;
+  for (int b = 0; b < bands; ++b) {
+    filterTasks.push_back(new FilterTask(this,
+      (int)((long long)height * b / bands),
+      (int)((long long)height * (b + 1) / bands), filters, &filtered[0]));
+    pool.add(filterTasks.back());
+  }
+  pool.wait();
+  for (size_t b = 0; b < filterTasks.size(); ++b)
+    delete filterTasks[b];
+
+  // then deflate slices of the filtered data in parallel
+  vector<DeflateTask*> slices;
+  for (size_t offset = 0; offset < total; offset += PNG_SLICE_SIZE) {
+    size_t length = std::min((size_t)PNG_SLICE_SIZE, total - offset);
+    slices.push_back(new DeflateTask(&filtered[offset], length,
+      std::min(offset, (size_t)WINDOW_SIZE), offset + length == total,
+      level, strategy));
+    pool.add(slices.back());
+  }
+  pool.wait();
+
+  // the zlib header, with the compression level it was made at
+  int flevel = level < 0 ? 2 : level < 2 ? 0 : level < 6 ? 1 :
+    level == 6 ? 2 : 3;
+  unsigned char zhead[2] = { 0x78, (unsigned char)(flevel << 6) };
+  zhead[1] += 31 - (zhead[0] * 256 + zhead[1]) % 31;
+
+  // check the slices and join their checksums
+  int status = 0;
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for (size_t s = 0; s < slices.size(); ++s) {
+    if (slices[s]->status) status = 1;
+    adler = adler32_combine(adler, slices[s]->adler, slices[s]->length);
+  }
+  if (status) cerr << "Could not compress PNG." << endl;
+
+  // write the signature and header
+  static const unsigned char signature[8] =
+    { 137, 80, 78, 71, 13, 10, 26, 10 };
+  unsigned char ihdr[13];
+  put32(ihdr, width);
+  put32(ihdr + 4, height);
+  ihdr[8] = 8;
+  ihdr[9] = colorType;
+  ihdr[10] = PNG_COMPRESSION_TYPE_DEFAULT;
+  ihdr[11] = PNG_FILTER_TYPE_DEFAULT;
+  ihdr[12] = PNG_INTERLACE_NONE;
+  bool ok = !status && writeBytes(fp, bytes, signature, 8) &&
+    writeChunk(fp, bytes, "IHDR", ihdr, 13);
+
+  // and the palette, if there is one
+  if (ok && colorType == PNG_COLOR_TYPE_PALETTE) {
+    ok = writeChunk(fp, bytes, "PLTE", (const unsigned char*)&palette[0],
+                    palette.size() * 3);
+    if (ok && !trans.empty())
+      ok = writeChunk(fp, bytes, "tRNS", &trans[0], trans.size());
+  }
+
+  // then the slices, the first led by the zlib header and the last
+  // followed by the checksum
+  for (size_t s = 0; ok && s < slices.size(); ++s) {
+    vector<unsigned char> &out = slices[s]->out;
+    if (s == 0) out.insert(out.begin(), zhead, zhead + 2);
+    if (s == slices.size() - 1) {
+      unsigned char trailer[4];
+      put32(trailer, adler);
+      out.insert(out.end(), trailer, trailer + 4);
+    }
+    ok = writeChunk(fp, bytes, "IDAT", &out[0], out.size());
+  }
+  ok = ok && writeChunk(fp, bytes, "IEND", NULL, 0);
+
+  for (size_t s = 0; s < slices.size(); ++s)
+    delete slices[s];
+
+  if (!ok && !status) cerr << "Could not write PNG." << endl;
+  return ok ? 0 : 1;
+}
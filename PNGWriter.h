@@ -16,23 +16,57 @@
 #ifndef PNGWRITER_H
 #define PNGWRITER_H
 
-#include <iostream>
+#include "ImageWriter.h"
+#include <string>
 #include <png.h>
+#include <stdint.h>
 
-using std::cerr;
-using std::endl;
+// bytes of filtered image data deflated by each thread of the parallel
+// encoder at a time
+#define PNG_SLICE_SIZE (128 * 1024)
 
-#define BYTES_PER_PIXEL 4
+// slots in the hash table of an image's colours, which is kept at most half
+// full so that a palette of up to 256 colours can be found
+#define PNG_COLOUR_SLOTS 1024
 
-class PNGWriter
+// how an image is compressed. -1 leaves a setting at libpng's default
+struct PNGOptions
+{
+  int level;      // zlib compression level, 0 to 9
+  int filters;    // PNG_FILTER_NONE etc., or'd together to let each row
+                  // pick whichever suits it
+  int strategy;   // Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE etc.
+  int threads;    // deflate slices of the image in parallel if above 1
+  bool rgba;      // always write RGBA pixels, rather than the smallest
+                  // format which holds the image exactly
+
+  PNGOptions() : level(-1), filters(-1), strategy(-1), threads(1),
+    rgba(false) {}
+};
+
+class PNGWriter : public ImageWriter
 {
   public:
-    PNGWriter(int width, int height, unsigned char *buffer);
-    int write(const char *filename);
+    PNGWriter(int width, int height, unsigned char *buffer,
+              const PNGOptions &options=PNGOptions());
+    static int parseFilters(const std::string &names);
+    static int parseStrategy(const std::string &name);
   protected:
-    int width;
-    int height;
-    unsigned char *image;
+    PNGOptions options;
+    int colorType;
+    int pixelBytes;
+    vector<png_color> palette;
+    vector<png_byte> trans;
+    vector<uint32_t> slotColours;
+    vector<int> slotIndices;
+    void chooseFormat();
+    bool addColour(uint32_t colour);
+    int findColour(uint32_t colour) const;
+    virtual int encode(FILE *file, vector<unsigned char> *bytes);
+    int encodeParallel(FILE *file, vector<unsigned char> *bytes);
+    void convertRow(int y, unsigned char *out) const;
+
+    friend class FilterTask;
 };
 
 #endif
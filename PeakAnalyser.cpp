@@ -0,0 +1,123 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "PeakAnalyser.h"
+#include "SIMD.h"
+
+#include <cfloat>
+
+// widen lo and hi to take in count samples, sixteen at a time into four
+// independent accumulators so that the comparisons can overlap
+static void minMax(const float *in, int count, float &lo, float &hi)
+{
+  int j = 0;
+
+  if (count >= 16) {
+    float4 lo0 = load4(in), lo1 = load4(in + 4);
+    float4 lo2 = load4(in + 8), lo3 = load4(in + 12);
+    float4 hi0 = lo0, hi1 = lo1, hi2 = lo2, hi3 = lo3;
+    for (j = 16; j + 16 <= count; j += 16) {
+      float4 a = load4(in + j), b = load4(in + j + 4);
+      float4 c = load4(in + j + 8), d = load4(in + j + 12);
+      lo0 = min4(lo0, a); hi0 = max4(hi0, a);
+      lo1 = min4(lo1, b); hi1 = max4(hi1, b);
+      lo2 = min4(lo2, c); hi2 = max4(hi2, c);
+      lo3 = min4(lo3, d); hi3 = max4(hi3, d);
+    }
+    float l[4], h[4];
+    store4(l, min4(min4(lo0, lo1), min4(lo2, lo3)));
+    store4(h, max4(max4(hi0, hi1), max4(hi2, hi3)));
+    for (int k = 0; k < 4; ++k) {
+      lo = std::min(lo, l[k]);
+      hi = std::max(hi, h[k]);
+    }
+  }
+
+  for (; j < count; ++j) {
+    lo = std::min(lo, in[j]);
+    hi = std::max(hi, in[j]);
+  }
+}
+
+PeakAnalyser::PeakAnalyser(int channels_in, int stepSize_in)
+  : channels(channels_in), stepSize(stepSize_in),
+    lo(channels_in), hi(channels_in)
+{
+  reset(0);
+}
+
+// minimum and maximum of each channel
+int PeakAnalyser::getBinCount()
+{
+  return channels * 2;
+}
+
+// start again, with the first step at startFrame
+void PeakAnalyser::reset(int64_t startFrame)
+{
+  std::fill(lo.begin(), lo.end(), FLT_MAX);
+  std::fill(hi.begin(), hi.end(), -FLT_MAX);
+  pending.clear();
+  filled = 0;
+  position = startFrame;
+}
+
+// take in count frames of each channel, handing every step which is
+// completed to the sink as a row of output 0
+void PeakAnalyser::process(const float *const *planar, int count,
+                           FeatureSink& sink, int sampleRate)
+{
+  int offset = 0;
+  while (offset < count) {
+    int n = std::min(count - offset, stepSize - filled);
+    for (int c = 0; c < channels; ++c)
+      minMax(planar[c] + offset, n, lo[c], hi[c]);
+    filled += n;
+    offset += n;
+    if (filled == stepSize) emit();
+  }
+
+  // pass on this chunk's rows together
+  if (!pending.empty()) {
+    size_t rows = pending.size() / getBinCount();
+    if (sink.wants(0))
+      sink.rows(0, &pending[0], getBinCount(), rows,
+                position - (int64_t)rows * stepSize, stepSize, sampleRate);
+    pending.clear();
+  }
+}
+
+// hand over the last, part-filled step, which only covers the frames which
+// were actually read
+void PeakAnalyser::finish(FeatureSink& sink, int sampleRate)
+{
+  if (filled == 0) return;
+  emit();
+  if (sink.wants(0))
+    sink.rows(0, &pending[0], getBinCount(), 1, position - stepSize,
+              stepSize, sampleRate);
+  pending.clear();
+}
+
+// close the current step
+void PeakAnalyser::emit()
+{
+  pending.insert(pending.end(), lo.begin(), lo.end());
+  pending.insert(pending.end(), hi.begin(), hi.end());
+  std::fill(lo.begin(), lo.end(), FLT_MAX);
+  std::fill(hi.begin(), hi.end(), -FLT_MAX);
+  filled = 0;
+  position += stepSize;
+}
@@ -0,0 +1,54 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef PEAKANALYSER_H
+#define PEAKANALYSER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "FeatureSink.h"
+#include "VisPlugin.h"
+
+// the version the peak analyser reports in place of a plugin version, and
+// its step size unless it is given one
+#define PEAKS_VERSION 1
+#define PEAKS_STEP 256
+
+// Finds the smallest and largest sample of each channel over every step of
+// the audio, straight from the decoded frames rather than through a Vamp
+// plugin. This is the analyser named by PEAKS_PLUGIN.
+class PeakAnalyser
+{
+  protected:
+    int channels;
+    int stepSize;
+    std::vector<float> lo;
+    std::vector<float> hi;
+    std::vector<float> pending;
+    int filled;
+    int64_t position;
+    void emit();
+
+  public:
+    PeakAnalyser(int channels, int stepSize);
+    int getBinCount();
+    void reset(int64_t startFrame);
+    void process(const float *const *planar, int count, FeatureSink& sink,
+                 int sampleRate);
+    void finish(FeatureSink& sink, int sampleRate);
+};
+
+#endif
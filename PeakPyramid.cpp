@@ -0,0 +1,387 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "PeakPyramid.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+using std::min;
+using std::max;
+
+// identifies pyramid files, written in the host's byte order
+#define PEAK_PYRAMID_MAGIC 0x52595056
+#define PEAK_PYRAMID_VERSION 2
+
+// levels stop halving once they are this short
+#define PEAK_PYRAMID_MIN_ROWS 16
+
+// level data starts on a boundary suitable for vector loads
+#define PEAK_PYRAMID_ALIGN 16
+
+PeakPyramid::PeakPyramid()
+{
+  mapping = NULL;
+  mappingSize = 0;
+  audioFrames = 0;
+  audioRate = 0;
+  audioChannels = 0;
+}
+
+PeakPyramid::~PeakPyramid()
+{
+  if (mapping) munmap(mapping, mappingSize);
+}
+
+// reads the directory at the start of the file, checking every value
+// against the end of the mapping
+class DirectoryReader
+{
+  public:
+    const unsigned char *p;
+    const unsigned char *end;
+
+    DirectoryReader(const unsigned char *start, size_t size)
+      : p(start), end(start + size) {}
+
+    template <typename T>
+    bool value(T *v) {
+      if ((size_t)(end - p) < sizeof(T)) return false;
+      memcpy(v, p, sizeof(T));
+      p += sizeof(T);
+      return true;
+    }
+
+    bool text(string *s) {
+      uint32_t length;
+      if (!value(&length) || (size_t)(end - p) < length) return false;
+      s->assign((const char*)p, length);
+      p += length;
+      return true;
+    }
+};
+
+// map a pyramid file. returns non-zero, warning unless the file doesn't
+// exist, if it can't be read
+int PeakPyramid::open(string path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (errno != ENOENT)
+      cerr << "WARNING: Could not open peak pyramid " << path << endl;
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    cerr << "WARNING: Could not read peak pyramid " << path << endl;
+    return 1;
+  }
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    cerr << "WARNING: Could not map peak pyramid " << path << endl;
+    return 1;
+  }
+  mapping = (unsigned char*)addr;
+  mappingSize = st.st_size;
+
+  DirectoryReader dir(mapping, mappingSize);
+  uint32_t magic = 0, version = 0, count = 0;
+  bool ok = dir.value(&magic) && magic == PEAK_PYRAMID_MAGIC &&
+            dir.value(&version) && version == PEAK_PYRAMID_VERSION &&
+            dir.text(&audioHash) && dir.value(&audioFrames) &&
+            dir.value(&audioRate) && dir.value(&audioChannels) &&
+            dir.value(&count);
+  for (uint32_t t = 0; ok && t < count; ++t)
+  {
+    string key;
+    Track track;
+    uint32_t levels = 0;
+    ok = dir.text(&key) && dir.value(&track.sampleRate) &&
+         dir.value(&track.bins) && dir.value(&track.start) &&
+         dir.value(&track.step) && dir.value(&levels) &&
+         track.bins > 0 && track.step > 0 && track.sampleRate > 0;
+    for (uint32_t l = 0; ok && l < levels; ++l)
+    {
+      Level level;
+      uint64_t offset = 0;
+      ok = dir.value(&level.rows) && dir.value(&offset) && level.rows >= 0 &&
+           offset % PEAK_PYRAMID_ALIGN == 0 && offset <= mappingSize &&
+           (uint64_t)level.rows <= (mappingSize - offset) /
+             (2 * track.bins * sizeof(float));
+      level.data = (const float*)(mapping + offset);
+      track.levels.push_back(level);
+    }
+    if (ok) tracks[key] = track;
+  }
+  if (!ok) {
+    cerr << "WARNING: Peak pyramid " << path << " is damaged or was written "
+      "by another version" << endl;
+    tracks.clear();
+    munmap(mapping, mappingSize);
+    mapping = NULL;
+    return 1;
+  }
+
+  // the levels are read in no particular order
+  madvise(mapping, mappingSize, MADV_RANDOM);
+  return 0;
+}
+
+// whether the pyramid was written for this audio, identified by the hash
+// of its content as well as its length and format
+bool PeakPyramid::matches(string hash, int64_t frames, int sampleRate,
+                          int channels) const
+{
+  return !hash.empty() && hash == audioHash && frames == audioFrames &&
+         sampleRate == audioRate && channels == audioChannels;
+}
+
+// the number of levels of peaks stored under a key, or -1 if it isn't
+// listed
+int PeakPyramid::levels(string key) const
+{
+  map<string, Track>::const_iterator t = tracks.find(key);
+  return t == tracks.end() ? -1 : (int)t->second.levels.size();
+}
+
+// read the peaks stored under a key, between start and end seconds (or to
+// the end of the audio if end is 0), into at most one row per column.
+// returns false if there are none
+bool PeakPyramid::read(string key, int columns, double start, double end,
+                       FeatureTable &out) const
+{
+  map<string, Track>::const_iterator t = tracks.find(key);
+  if (t == tracks.end() || t->second.levels.empty() || columns < 1)
+    return false;
+  const Track &track = t->second;
+  int64_t from = llround(start * track.sampleRate);
+  int64_t to = end > 0 ? llround(end * track.sampleRate) : -1;
+
+  // use the coarsest level with a row for every column
+  int level;
+  int64_t step = 0, first = 0, last = 0;
+  for (level = track.levels.size() - 1; level >= 0; --level)
+  {
+    step = track.step << level;
+    int64_t rows = track.levels[level].rows;
+    first = from <= track.start ? 0 : min((from - track.start) / step, rows);
+    last = to < 0 ? rows :
+      max(first, min((to - track.start + step - 1) / step, rows));
+    if (last - first >= columns) break;
+  }
+  if (level < 0) level = 0;
+
+  // combine the level's rows down to the number of columns
+  const float *data = track.levels[level].data;
+  int bins = track.bins;
+  int64_t count = last - first;
+  int rows = (int)min(count, (int64_t)columns);
+  out.sampleRate = track.sampleRate;
+  out.bins = 2 * bins;
+  out.values.resize((size_t)rows * 2 * bins);
+  out.offsets.clear();
+  out.positions.resize(rows);
+  out.durations.clear();
+  out.labels.clear();
+  for (int r = 0; r < rows; ++r)
+  {
+    int64_t a = first + count * r / rows;
+    int64_t b = first + count * (r + 1) / rows;
+    float *dest = &out.values[(size_t)r * 2 * bins];
+    memcpy(dest, data + a * 2 * bins, 2 * bins * sizeof(float));
+    for (int64_t i = a + 1; i < b; ++i) {
+      const float *row = data + i * 2 * bins;
+      for (int k = 0; k < bins; ++k) {
+        dest[k] = min(dest[k], row[k]);
+        dest[bins + k] = max(dest[bins + k], row[bins + k]);
+      }
+    }
+    out.positions[r] = track.start + a * step;
+  }
+
+  return true;
+}
+
+// build the levels of one table, or return false if its features aren't
+// evenly spaced rows of the same size
+static bool buildLevels(const FeatureTable &table, int64_t *step,
+                        vector<vector<float> > &levels)
+{
+  size_t n = table.size();
+  int bins = table.bins;
+  if (n == 0 || bins < 1) return false;
+  *step = n > 1 ? table.positions[1] - table.positions[0] : 1;
+  if (*step <= 0) return false;
+  for (size_t i = 1; i < n; ++i)
+    if (table.positions[i] != table.positions[0] + (int64_t)i * *step)
+      return false;
+
+  // the minimum and maximum of a single feature are its values
+  levels.assign(1, vector<float>(n * 2 * bins));
+  for (size_t i = 0; i < n; ++i) {
+    const float *values = table.row(i);
+    std::copy(values, values + bins, &levels[0][i * 2 * bins]);
+    std::copy(values, values + bins, &levels[0][i * 2 * bins + bins]);
+  }
+
+  while (levels.back().size() / (2 * bins) > PEAK_PYRAMID_MIN_ROWS)
+  {
+    const vector<float> &below = levels.back();
+    size_t belowRows = below.size() / (2 * bins);
+    size_t rows = (belowRows + 1) / 2;
+    vector<float> level(rows * 2 * bins);
+    for (size_t i = 0; i < rows; ++i) {
+      const float *a = &below[2 * i * 2 * bins];
+      const float *b = 2 * i + 1 < belowRows ? a + 2 * bins : a;
+      float *dest = &level[i * 2 * bins];
+      for (int k = 0; k < bins; ++k) {
+        dest[k] = min(a[k], b[k]);
+        dest[bins + k] = max(a[bins + k], b[bins + k]);
+      }
+    }
+    levels.push_back(level);
+  }
+  return true;
+}
+
+template <typename T>
+static void writeValue(FILE *f, T value)
+{
+  fwrite(&value, sizeof(T), 1, f);
+}
+
+static void writeString(FILE *f, const string &s)
+{
+  writeValue(f, (uint32_t)s.size());
+  fwrite(s.data(), 1, s.size(), f);
+}
+
+static uint64_t align(uint64_t offset)
+{
+  return (offset + PEAK_PYRAMID_ALIGN - 1) / PEAK_PYRAMID_ALIGN *
+    PEAK_PYRAMID_ALIGN;
+}
+
+// open a new file with a unique name next to path, for writing
+static FILE *createTemporary(string path, string *tmp)
+{
+  vector<char> name(path.begin(), path.end());
+  const char suffix[] = ".XXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(&name[0]);
+  if (fd < 0) return NULL;
+  fchmod(fd, 0644);
+  *tmp = &name[0];
+  FILE *f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp->c_str());
+  }
+  return f;
+}
+
+// write the peaks of each table under its key, for the audio with the
+// given hash, length and format
+int PeakPyramid::write(string path, const vector<string> &keys,
+                       const vector<const FeatureTable*> &tables,
+                       string hash, int64_t frames, int sampleRate,
+                       int channels)
+{
+  vector<int64_t> steps(tables.size(), 1);
+  vector<vector<vector<float> > > levels(tables.size());
+  for (size_t t = 0; t < tables.size(); ++t)
+  {
+    if (!buildLevels(*tables[t], &steps[t], levels[t])) {
+      levels[t].clear();
+      steps[t] = 1;
+      cerr << "WARNING: Features of " << keys[t].substr(0, keys[t].find('\n'))
+        << " are not evenly spaced rows, leaving their peaks out of the "
+        "pyramid" << endl;
+    }
+  }
+
+  // lay the levels out after the directory
+  uint64_t offset = 4 + 4 + 4 + hash.size() + 8 + 4 + 4 + 4;
+  for (size_t s = 0; s < tables.size(); ++s)
+    offset += 4 + keys[s].size() + 4 + 4 + 8 + 8 + 4 + levels[s].size() * 16;
+  vector<vector<uint64_t> > offsets(tables.size());
+  for (size_t s = 0; s < tables.size(); ++s) {
+    for (size_t l = 0; l < levels[s].size(); ++l) {
+      offset = align(offset);
+      offsets[s].push_back(offset);
+      offset += levels[s][l].size() * sizeof(float);
+    }
+  }
+
+  // write to a private file which is renamed into place, so that a reader
+  // never sees part of a pyramid
+  string tmp;
+  FILE *f = createTemporary(path, &tmp);
+  if (!f) {
+    cerr << "WARNING: Could not write peak pyramid " << path << endl;
+    return 1;
+  }
+
+  writeValue(f, (uint32_t)PEAK_PYRAMID_MAGIC);
+  writeValue(f, (uint32_t)PEAK_PYRAMID_VERSION);
+  writeString(f, hash);
+  writeValue(f, frames);
+  writeValue(f, sampleRate);
+  writeValue(f, channels);
+  writeValue(f, (uint32_t)tables.size());
+  for (size_t s = 0; s < tables.size(); ++s) {
+    const FeatureTable &table = *tables[s];
+    writeString(f, keys[s]);
+    writeValue(f, max(table.sampleRate, 1));
+    writeValue(f, max(table.bins, 1));
+    writeValue(f, table.size() ? table.positions[0] : (int64_t)0);
+    writeValue(f, steps[s]);
+    writeValue(f, (uint32_t)levels[s].size());
+    for (size_t l = 0; l < levels[s].size(); ++l) {
+      writeValue(f, (int64_t)(levels[s][l].size() / (2 * table.bins)));
+      writeValue(f, offsets[s][l]);
+    }
+  }
+  for (size_t s = 0; s < tables.size(); ++s) {
+    for (size_t l = 0; l < levels[s].size(); ++l) {
+      static const char padding[PEAK_PYRAMID_ALIGN] = {0};
+      long position = ftell(f);
+      if (position >= 0 && (uint64_t)position < offsets[s][l])
+        fwrite(padding, 1, offsets[s][l] - position, f);
+      fwrite(&levels[s][l][0], sizeof(float), levels[s][l].size(), f);
+    }
+  }
+
+  bool ok = !ferror(f);
+  if (fclose(f) != 0) ok = false;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    cerr << "WARNING: Could not write peak pyramid " << path << endl;
+    unlink(tmp.c_str());
+    return 1;
+  }
+  return 0;
+}
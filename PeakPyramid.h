@@ -0,0 +1,78 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef PEAKPYRAMID_H
+#define PEAKPYRAMID_H
+
+#include "FeatureStore.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using std::map;
+using std::string;
+using std::vector;
+
+// Min/max peaks of Vamp plugin outputs at successively halved resolutions,
+// in a file which is memory-mapped so that the audio can be drawn again at
+// any width, or over any time range, without being analysed. Level 0 has a
+// row for each feature, holding the minimum of every bin followed by the
+// maximum of every bin, and each level above combines pairs of rows of the
+// one below. Reading touches only the coarsest level which still has a row
+// for every pixel column.
+//
+// Outputs whose features can't be stacked into levels are listed without
+// any, so that they are known to need analysing rather than missing.
+class PeakPyramid
+{
+  protected:
+    struct Level
+    {
+      int64_t rows;
+      const float *data;
+    };
+    struct Track
+    {
+      int sampleRate;
+      int bins;
+      int64_t start;     // sample frame of the first row
+      int64_t step;      // frames between rows of level 0
+      vector<Level> levels;
+    };
+    unsigned char *mapping;
+    size_t mappingSize;
+    int64_t audioFrames;
+    int audioRate;
+    int audioChannels;
+    string audioHash;
+    map<string, Track> tracks;
+
+  public:
+    PeakPyramid();
+    ~PeakPyramid();
+    int open(string path);
+    bool matches(string hash, int64_t frames, int sampleRate,
+                 int channels) const;
+    int levels(string key) const;
+    bool read(string key, int columns, double start, double end,
+              FeatureTable &out) const;
+    static int write(string path, const vector<string> &keys,
+                     const vector<const FeatureTable*> &tables,
+                     string hash, int64_t frames, int sampleRate,
+                     int channels);
+};
+
+#endif
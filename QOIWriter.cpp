@@ -0,0 +1,122 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "QOIWriter.h"
+
+#include <cstring>
+#include <stdint.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+
+QOIWriter::QOIWriter(int width, int height, unsigned char *buffer)
+  : ImageWriter(width, height, buffer)
+{
+}
+
+static void put32(unsigned char *p, uint32_t value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+int QOIWriter::encode(FILE *fp, vector<unsigned char> *bytes)
+{
+  // the header, which says whether there is any alpha
+  unsigned char header[14] = { 'q', 'o', 'i', 'f' };
+  put32(header + 4, width);
+  put32(header + 8, height);
+  header[12] = isOpaque() ? 3 : 4;
+  header[13] = 0;
+  bool ok = writeBytes(fp, bytes, header, 14);
+
+  // the pixels, each as a run of the one before, a recently seen colour, a
+  // small difference from the one before, or in full
+  vector<unsigned char> out(QOI_BATCH_SIZE + 8);
+  size_t n = 0;
+  unsigned char index[64][4];
+  memset(index, 0, sizeof(index));
+  unsigned char prev[4] = { 0, 0, 0, 255 };
+  int run = 0;
+  size_t pixels = (size_t)width * height;
+  const unsigned char *in = image;
+  for (size_t i = 0; ok && i < pixels; ++i, in += BYTES_PER_PIXEL) {
+    unsigned char px[4] = { in[2], in[1], in[0], in[3] };
+
+    if (memcmp(px, prev, 4) == 0) {
+      if (++run == 62 || i == pixels - 1) {
+        out[n++] = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+    } else {
+      if (run > 0) {
+        out[n++] = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+
+      int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      if (memcmp(index[hash], px, 4) == 0) {
+        out[n++] = QOI_OP_INDEX | hash;
+      } else {
+        memcpy(index[hash], px, 4);
+        if (px[3] == prev[3]) {
+          signed char vr = px[0] - prev[0];
+          signed char vg = px[1] - prev[1];
+          signed char vb = px[2] - prev[2];
+          signed char vgr = vr - vg;
+          signed char vgb = vb - vg;
+          if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+            out[n++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 |
+              (vb + 2);
+          } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 &&
+                     vgb > -9 && vgb < 8) {
+            out[n++] = QOI_OP_LUMA | (vg + 32);
+            out[n++] = (vgr + 8) << 4 | (vgb + 8);
+          } else {
+            out[n++] = QOI_OP_RGB;
+            out[n++] = px[0];
+            out[n++] = px[1];
+            out[n++] = px[2];
+          }
+        } else {
+          out[n++] = QOI_OP_RGBA;
+          memcpy(&out[n], px, 4);
+          n += 4;
+        }
+      }
+    }
+    memcpy(prev, px, 4);
+
+    if (n >= QOI_BATCH_SIZE) {
+      ok = writeBytes(fp, bytes, &out[0], n);
+      n = 0;
+    }
+  }
+
+  // the end marker
+  static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  memcpy(&out[n], end, 8);
+  n += 8;
+  ok = ok && writeBytes(fp, bytes, &out[0], n);
+
+  if (!ok) cerr << "Could not write image." << endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef QOIWRITER_H
+#define QOIWRITER_H
+
+#include "ImageWriter.h"
+
+// bytes of encoded image held before they are written
+#define QOI_BATCH_SIZE (64 * 1024)
+
+// Writes the "Quite OK Image" format, which is lossless like PNG but
+// encodes each pixel in a single pass without deflate, trading some size
+// for a great deal of speed.
+class QOIWriter : public ImageWriter
+{
+  public:
+    QOIWriter(int width, int height, unsigned char *buffer);
+  protected:
+    virtual int encode(FILE *file, vector<unsigned char> *bytes);
+};
+
+#endif
@@ -0,0 +1,154 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Renderer.h"
+#include "VisHost.h"
+#include "PNGWriter.h"
+#include "ImageWriter.h"
+
+Renderer::Renderer(const std::string &pluginPath)
+{
+  host = new VisHost(pluginPath);
+}
+
+Renderer::~Renderer()
+{
+  delete host;
+}
+
+// load the visualisation plugin
+int Renderer::init()
+{
+  return host->init();
+}
+
+void Renderer::setVerbose(bool verbose)
+{
+  host->verbose = verbose;
+}
+
+void Renderer::setSinglePass(bool singlePass)
+{
+  host->singlePass = singlePass;
+}
+
+void Renderer::setJobs(int jobs)
+{
+  host->jobs = jobs;
+}
+
+void Renderer::setShards(int shards, double overlap)
+{
+  host->shards = shards;
+  host->shardOverlap = overlap;
+}
+
+void Renderer::setCache(const std::string &dir, long long megabytes)
+{
+  host->cacheDir = dir;
+  host->cacheSize = (off_t)megabytes << 20;
+}
+
+// draw peaks from a pyramid file, which is written by the next process call
+// if it doesn't hold them
+void Renderer::setPyramid(const std::string &path)
+{
+  host->pyramidPath = path;
+}
+
+// draw only the audio between start and end seconds, or to the end if end
+// is 0
+void Renderer::setRange(double start, double end)
+{
+  host->rangeStart = start;
+  host->rangeEnd = end;
+}
+
+// how renderPNG compresses the image: the zlib level (0 to 9), a mask of
+// PNG_FILTER_* values and a zlib strategy, each -1 for libpng's default,
+// the number of threads to deflate with, and whether to write RGBA pixels
+// rather than the smallest format which holds the image
+void Renderer::setPNG(int level, int filters, int strategy, int threads,
+                      bool rgba)
+{
+  host->png.level = level;
+  host->png.filters = filters;
+  host->png.strategy = strategy;
+  host->png.threads = threads;
+  host->png.rgba = rgba;
+}
+
+int Renderer::processFile(const std::string &path)
+{
+  return host->process(AudioSource(path));
+}
+
+// analyse an audio file held in memory, in any format libsndfile can read
+int Renderer::processMemory(const void *image, size_t size)
+{
+  return host->process(AudioSource(image, size));
+}
+
+int Renderer::processFloats(const float *frames, long long count,
+                            int channels, int sampleRate)
+{
+  return host->process(AudioSource(frames, count, channels, sampleRate));
+}
+
+int Renderer::renderARGB(int width, int height,
+                         std::vector<unsigned char> &argb)
+{
+  if (width < 1 || height < 1) {
+    cerr << "ERROR: Image must be at least 1 pixel wide and high." << endl;
+    return 1;
+  }
+  argb.assign((size_t)width * height * BYTES_PER_PIXEL, 0);
+  return host->render(width, height, &argb[0]);
+}
+
+int Renderer::renderPNG(int width, int height,
+                        std::vector<unsigned char> &png)
+{
+  std::vector<unsigned char> argb;
+  if (renderARGB(width, height, argb)) return 1;
+  png.clear();
+  PNGWriter writer(width, height, &argb[0], host->png);
+  return writer.write(png);
+}
+
+int Renderer::renderImage(int width, int height, const std::string &format,
+                          std::vector<unsigned char> &image)
+{
+  int imageFormat = ImageWriter::parseFormat(format);
+  if (imageFormat < 0) {
+    cerr << "ERROR: Unknown image format \"" << format << "\"." << endl;
+    return 1;
+  }
+  std::vector<unsigned char> argb;
+  if (renderARGB(width, height, argb)) return 1;
+  image.clear();
+  ImageWriter *writer = ImageWriter::create(imageFormat, width, height,
+                                            &argb[0], host->png);
+  int status = writer->write(image);
+  delete writer;
+  return status;
+}
+
+// the interface version the library was built with, for programs to check
+// against VAMPEYER_API_VERSION at run time
+int Renderer::apiVersion()
+{
+  return VAMPEYER_API_VERSION;
+}
@@ -0,0 +1,79 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// version of the library interface, bumped whenever this class changes in
+// a way that breaks programs built against an earlier version
+#define VAMPEYER_API_VERSION 1
+
+class VisHost;
+
+// The public interface of libvampeyer, for programs which render
+// visualisations themselves rather than running the vampeyer command.
+// A renderer loads one visualisation plugin, analyses audio from a file or
+// from memory, and renders the result as an ARGB bitmap or as PNG bytes.
+// Only a pointer to the host is held, so that the layout of the class stays
+// the same as the host changes. Functions returning int return 0 on
+// success, and errors are reported on stderr.
+class Renderer
+{
+  public:
+    Renderer(const std::string &pluginPath);
+    ~Renderer();
+    int init();
+
+    // analysis settings, as the command line options of the same names
+    void setVerbose(bool verbose);
+    void setSinglePass(bool singlePass);
+    void setJobs(int jobs);
+    void setShards(int shards, double overlap=1.0);
+    void setCache(const std::string &dir, long long megabytes=1024);
+    void setPyramid(const std::string &path);
+    void setRange(double start, double end=0);
+    void setPNG(int level, int filters=-1, int strategy=-1, int threads=1,
+                bool rgba=false);
+
+    // analyse audio. the memory of an in-memory file image, or of
+    // interleaved float frames, need only stay valid until the call returns
+    int processFile(const std::string &path);
+    int processMemory(const void *image, size_t size);
+    int processFloats(const float *frames, long long count, int channels,
+                      int sampleRate);
+
+    // render the analysed audio, replacing the contents of the vector with
+    // width * height 4-byte pixels, a PNG file, or a file in the named
+    // format ("png", "ppm", "pam" or "qoi")
+    int renderARGB(int width, int height, std::vector<unsigned char> &argb);
+    int renderPNG(int width, int height, std::vector<unsigned char> &png);
+    int renderImage(int width, int height, const std::string &format,
+                    std::vector<unsigned char> &image);
+
+    static int apiVersion();
+
+  protected:
+    VisHost *host;
+
+  private:
+    Renderer(const Renderer&);
+    Renderer &operator=(const Renderer&);
+};
+
+#endif
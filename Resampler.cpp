@@ -0,0 +1,230 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Resampler.h"
+#include <cmath>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Kaiser window shape, giving roughly 80dB of stopband attenuation
+#define KAISER_BETA 8.0
+
+// keep the passband edge just below the lower Nyquist frequency
+#define RESAMPLER_ROLLOFF 0.95
+
+static int gcd(int a, int b)
+{
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double bessel0(double x)
+{
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 50; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12) break;
+  }
+  return sum;
+}
+
+// multiply-accumulate n samples, where n is a multiple of four
+static inline float dot(const float *a, const float *b, int n)
+{
+  int j = 0;
+  float sum = 0.0f;
+#if defined(__SSE__)
+  __m128 acc = _mm_setzero_ps();
+  for (; j + 4 <= n; j += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j)));
+  float part[4];
+  _mm_storeu_ps(part, acc);
+  sum = (part[0] + part[1]) + (part[2] + part[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (; j + 4 <= n; j += 4)
+    acc = vmlaq_f32(acc, vld1q_f32(a + j), vld1q_f32(b + j));
+  float part[4];
+  vst1q_f32(part, acc);
+  sum = (part[0] + part[1]) + (part[2] + part[3]);
+#endif
+  for (; j < n; ++j) sum += a[j] * b[j];
+  return sum;
+}
+
+Resampler::Resampler(int channels_in, int fromRate, int toRate)
+{
+  channels = channels_in;
+  int g = gcd(fromRate, toRate);
+  up = toRate / g;
+  down = fromRate / g;
+
+  // when decimating, narrow the filter to the output Nyquist frequency and
+  // widen it to keep the same number of zero crossings
+  double cutoff = RESAMPLER_ROLLOFF * std::min(1.0, (double)up / down);
+  halfWidth = (int)ceil(RESAMPLER_ZERO_CROSSINGS / cutoff);
+  taps = (2 * halfWidth + 3) & ~3;
+
+  // one set of taps for each fractional offset of the output frame
+  coeffs = new float[up * taps];
+  for (int p = 0; p < up; ++p) {
+    float *h = coeffs + p * taps;
+    double sum = 0.0;
+    for (int k = 0; k < taps; ++k) {
+      double x = (k - (halfWidth - 1)) - (double)p / up;
+      double r = x / halfWidth;
+      double v = 0.0;
+      if (r > -1.0 && r < 1.0) {
+        double s = (x == 0.0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+        v = cutoff * s * bessel0(KAISER_BETA * sqrt(1.0 - r * r));
+      }
+      h[k] = v;
+      sum += v;
+    }
+
+    // unity gain at DC for every phase
+    for (int k = 0; k < taps; ++k) h[k] /= sum;
+  }
+
+  history = new std::vector<float>[channels];
+  seek(0);
+}
+
+Resampler::~Resampler()
+{
+  delete[] coeffs;
+  delete[] history;
+}
+
+// the number of frames the output of a stream of the given length holds
+sf_count_t Resampler::outputFrames(sf_count_t frames, int fromRate,
+                                   int toRate)
+{
+  int g = gcd(fromRate, toRate);
+  return (frames * (toRate / g) + fromRate / g - 1) / (fromRate / g);
+}
+
+// start again so that the next output is the given frame, returning the
+// input frame to start feeding from
+sf_count_t Resampler::seek(sf_count_t frame)
+{
+  next = frame;
+  base = frame * down / up - (halfWidth - 1);
+  inputEnd = std::max(base, (sf_count_t)0);
+
+  // the filter runs over silence before the start of the stream
+  for (int c = 0; c < channels; ++c)
+    history[c].assign(base < 0 ? -base : 0, 0.0f);
+  return inputEnd;
+}
+
+// filter every output frame that the history now covers, up to limit if it
+// is not negative
+int Resampler::produce(sf_count_t limit)
+{
+  sf_count_t available = base + history[0].size();
+  size_t maxFrames = history[0].size() * up / down + 2;
+  if (outbuf.size() < maxFrames * channels) outbuf.resize(maxFrames * channels);
+
+  int count = 0;
+  while (limit < 0 || next < limit) {
+    sf_count_t pos = next * down;
+    sf_count_t first = pos / up - (halfWidth - 1);
+    if (first + taps > available) break;
+    const float *h = coeffs + (pos % up) * taps;
+    float *out = &outbuf[count * channels];
+    for (int c = 0; c < channels; ++c)
+      out[c] = dot(&history[c][first - base], h, taps);
+    ++count;
+    ++next;
+  }
+
+  // drop the input that no later output frame needs
+  sf_count_t drop = next * down / up - (halfWidth - 1) - base;
+  if (drop > 0) {
+    for (int c = 0; c < channels; ++c)
+      history[c].erase(history[c].begin(), history[c].begin() + drop);
+    base += drop;
+  }
+  return count;
+}
+
+// resample count interleaved frames, returning the number of frames written
+// to out which stays valid until the next call
+int Resampler::process(const float *frames, int count, const float **out)
+{
+  for (int c = 0; c < channels; ++c) {
+    std::vector<float> &h = history[c];
+    size_t size = h.size();
+    h.resize(size + count);
+    for (int j = 0; j < count; ++j) h[size + j] = frames[j * channels + c];
+  }
+  inputEnd += count;
+
+  count = produce(-1);
+  *out = &outbuf[0];
+  return count;
+}
+
+// produce the last frames at the end of the stream
+int Resampler::flush(const float **out)
+{
+  for (int c = 0; c < channels; ++c)
+    history[c].resize(history[c].size() + taps, 0.0f);
+
+  int count = produce((inputEnd * up + down - 1) / down);
+  *out = &outbuf[0];
+  return count;
+}
+
+ResamplingReader::ResamplingReader(AudioReader &source_in, int channels,
+                                   int fromRate, int toRate)
+  : source(source_in), resampler(channels, fromRate, toRate)
+{
+  flushed = false;
+}
+
+int ResamplingReader::read(const float **frames)
+{
+  while (!flushed) {
+    const float *in;
+    int count = source.read(&in);
+    if (count < 0) return -1;
+    if (count == 0) {
+      flushed = true;
+      return resampler.flush(frames);
+    }
+    count = resampler.process(in, count, frames);
+    if (count > 0) return count;
+  }
+  return 0;
+}
+
+// move to a frame of the resampled stream
+int ResamplingReader::seek(sf_count_t frame)
+{
+  flushed = false;
+  return source.seek(resampler.seek(frame));
+}
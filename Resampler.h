@@ -0,0 +1,69 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include "AudioReader.h"
+#include <vector>
+
+// zero crossings of the windowed sinc on each side of its centre
+#define RESAMPLER_ZERO_CROSSINGS 16
+
+// Converts interleaved audio between sample rates with a polyphase
+// Kaiser-windowed sinc filter. Output frame n is centred on input time
+// n * fromRate / toRate, so the filter adds no delay.
+class Resampler
+{
+  protected:
+    int channels;
+    int up;             // interpolation factor
+    int down;           // decimation factor
+    int taps;           // filter taps per phase
+    int halfWidth;      // input frames needed either side of the centre
+    float *coeffs;      // taps for each of the up phases
+    std::vector<float> *history;
+    sf_count_t base;    // input frame held at the start of the history
+    sf_count_t inputEnd;
+    sf_count_t next;    // next output frame
+    std::vector<float> outbuf;
+    int produce(sf_count_t limit);
+
+  public:
+    Resampler(int channels, int fromRate, int toRate);
+    ~Resampler();
+    int process(const float *frames, int count, const float **out);
+    int flush(const float **out);
+    sf_count_t seek(sf_count_t frame);
+    static sf_count_t outputFrames(sf_count_t frames, int fromRate,
+                                   int toRate);
+};
+
+// Reads audio from another reader at a different sample rate.
+class ResamplingReader : public AudioReader
+{
+  protected:
+    AudioReader &source;
+    Resampler resampler;
+    bool flushed;
+
+  public:
+    ResamplingReader(AudioReader &source, int channels, int fromRate,
+                     int toRate);
+    virtual int read(const float **frames);
+    virtual int seek(sf_count_t frame);
+};
+
+#endif
@@ -0,0 +1,170 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "RingBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using std::min;
+
+RingBuffer::RingBuffer(int channels_in, int minFrames)
+{
+  channels = channels_in;
+  readPos = 0;
+  writePos = 0;
+  bytesCopied = 0;
+
+  // mappings must be a whole number of pages
+  int pageFrames = sysconf(_SC_PAGESIZE) / sizeof(float);
+  capacity = ((minFrames + pageFrames - 1) / pageFrames) * pageFrames;
+
+  rings = new float*[channels];
+  blockPtrs = new float*[channels];
+  tailPtrs = new float*[channels];
+  mapped = true;
+  for (int c = 0; c < channels; ++c) rings[c] = NULL;
+  for (int c = 0; c < channels && mapped; ++c) mapped = map(c);
+
+  // fall back to mirrored writes into plain buffers
+  if (!mapped) {
+    for (int c = 0; c < channels; ++c) {
+      if (rings[c]) munmap(rings[c], 2 * capacity * sizeof(float));
+      rings[c] = new float[2 * capacity];
+    }
+  }
+}
+
+RingBuffer::~RingBuffer()
+{
+  for (int c = 0; c < channels; ++c) {
+    if (mapped) munmap(rings[c], 2 * capacity * sizeof(float));
+    else delete[] rings[c];
+  }
+  delete[] rings;
+  delete[] blockPtrs;
+  delete[] tailPtrs;
+}
+
+// map one page-aligned buffer into two adjacent ranges of address space
+bool RingBuffer::map(int c)
+{
+#ifdef MFD_CLOEXEC
+  size_t size = capacity * sizeof(float);
+  int fd = memfd_create("vampeyer-ring", MFD_CLOEXEC);
+  if (fd < 0) return false;
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // reserve space for both copies, then map the buffer over each half
+  char *base = (char*)mmap(NULL, 2 * size, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED ||
+      mmap(base + size, size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, 2 * size);
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  rings[c] = (float*)base;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// pointers to where the next frames of each channel should be written
+//
+// up to space() frames may be written, even past the end of a mapped ring,
+// where they land at its start
+float **RingBuffer::tail()
+{
+  int pos = writePos % capacity;
+  for (int c = 0; c < channels; ++c) tailPtrs[c] = rings[c] + pos;
+  return tailPtrs;
+}
+
+// add frames written through tail() to the ring
+void RingBuffer::commit(int count)
+{
+  bytesCopied += (sf_count_t)count * channels * sizeof(float);
+  if (!mapped) mirror(writePos % capacity, count);
+  writePos += count;
+}
+
+// append silence to each channel
+void RingBuffer::silence(int count)
+{
+  int pos = writePos % capacity;
+  for (int c = 0; c < channels; ++c)
+    memset(rings[c] + pos, 0, count * sizeof(float));
+  if (!mapped) mirror(pos, count);
+  writePos += count;
+}
+
+// copy freshly written frames into the other half of an unmapped ring
+void RingBuffer::mirror(int pos, int count)
+{
+  int head = min(count, capacity - pos);
+  for (int c = 0; c < channels; ++c) {
+    float *ring = rings[c];
+    memcpy(ring + pos + capacity, ring + pos, head * sizeof(float));
+    memcpy(ring, ring + capacity, (count - head) * sizeof(float));
+  }
+  bytesCopied += (sf_count_t)count * channels * sizeof(float);
+}
+
+// discard the oldest frames
+void RingBuffer::advance(int count)
+{
+  readPos += count;
+  if (readPos > writePos) readPos = writePos;
+}
+
+// number of frames held
+int RingBuffer::available()
+{
+  return writePos - readPos;
+}
+
+// number of frames that can be written without overwriting held frames
+int RingBuffer::space()
+{
+  return capacity - available();
+}
+
+// pointers to the held frames of each channel, contiguous from the oldest
+float **RingBuffer::block()
+{
+  int pos = readPos % capacity;
+  for (int c = 0; c < channels; ++c) blockPtrs[c] = rings[c] + pos;
+  return blockPtrs;
+}
+
+sf_count_t RingBuffer::getBytesCopied()
+{
+  return bytesCopied;
+}
@@ -0,0 +1,56 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <sndfile.h>
+
+// Holds the most recent frames of audio for each channel, de-interleaved.
+//
+// Each channel's storage is mapped twice in a row in virtual memory, so a
+// block starting anywhere in the ring can be handed to a plugin as one
+// contiguous array without moving any data when the ring wraps. If the
+// double mapping is not available, every sample is mirrored into both
+// halves of an ordinary buffer instead.
+class RingBuffer
+{
+  protected:
+    int channels;
+    int capacity;
+    bool mapped;
+    float **rings;
+    float **blockPtrs;
+    float **tailPtrs;
+    sf_count_t readPos;
+    sf_count_t writePos;
+    sf_count_t bytesCopied;
+    bool map(int c);
+    void mirror(int pos, int count);
+
+  public:
+    RingBuffer(int channels, int minFrames);
+    ~RingBuffer();
+    float **tail();
+    void commit(int count);
+    void silence(int count);
+    void advance(int count);
+    int available();
+    int space();
+    float **block();
+    sf_count_t getBytesCopied();
+};
+
+#endif
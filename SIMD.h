@@ -0,0 +1,85 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <algorithm>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Four floats at a time, with SSE on x86, NEON on ARM or plain loops
+// elsewhere, for the host's own number crunching.
+#if defined(__SSE__)
+typedef __m128 float4;
+static inline float4 load4(const float *p) { return _mm_loadu_ps(p); }
+static inline void store4(float *p, float4 a) { _mm_storeu_ps(p, a); }
+static inline float4 min4(float4 a, float4 b) { return _mm_min_ps(a, b); }
+static inline float4 max4(float4 a, float4 b) { return _mm_max_ps(a, b); }
+static inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+static inline float4 addSquare4(float4 a, float4 b)
+{
+  return _mm_add_ps(a, _mm_mul_ps(b, b));
+}
+#elif defined(__ARM_NEON)
+typedef float32x4_t float4;
+static inline float4 load4(const float *p) { return vld1q_f32(p); }
+static inline void store4(float *p, float4 a) { vst1q_f32(p, a); }
+static inline float4 min4(float4 a, float4 b) { return vminq_f32(a, b); }
+static inline float4 max4(float4 a, float4 b) { return vmaxq_f32(a, b); }
+static inline float4 add4(float4 a, float4 b) { return vaddq_f32(a, b); }
+static inline float4 addSquare4(float4 a, float4 b)
+{
+  return vmlaq_f32(a, b, b);
+}
+#else
+struct float4 { float v[4]; };
+static inline float4 load4(const float *p)
+{
+  float4 a;
+  for (int k = 0; k < 4; ++k) a.v[k] = p[k];
+  return a;
+}
+static inline void store4(float *p, float4 a)
+{
+  for (int k = 0; k < 4; ++k) p[k] = a.v[k];
+}
+static inline float4 min4(float4 a, float4 b)
+{
+  for (int k = 0; k < 4; ++k) a.v[k] = std::min(a.v[k], b.v[k]);
+  return a;
+}
+static inline float4 max4(float4 a, float4 b)
+{
+  for (int k = 0; k < 4; ++k) a.v[k] = std::max(a.v[k], b.v[k]);
+  return a;
+}
+static inline float4 add4(float4 a, float4 b)
+{
+  for (int k = 0; k < 4; ++k) a.v[k] += b.v[k];
+  return a;
+}
+static inline float4 addSquare4(float4 a, float4 b)
+{
+  for (int k = 0; k < 4; ++k) a.v[k] += b.v[k] * b.v[k];
+  return a;
+}
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int numThreads)
+{
+  pending = 0;
+  stopping = false;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&ready, NULL);
+  pthread_cond_init(&done, NULL);
+
+  // start the workers
+  for (int i=0; i<numThreads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, this) == 0)
+      threads.push_back(thread);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  // let the workers drain the queue, then stop them
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&ready);
+  pthread_mutex_unlock(&mutex);
+  for (unsigned int i=0; i<threads.size(); i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&ready);
+  pthread_mutex_destroy(&mutex);
+}
+
+// queue a task to be run by the next free worker
+void ThreadPool::add(Task *task)
+{
+  // without any workers, run the task on the calling thread
+  if (threads.empty()) {
+    task->run();
+    return;
+  }
+
+  pthread_mutex_lock(&mutex);
+  queue.push_back(task);
+  pending++;
+  pthread_cond_signal(&ready);
+  pthread_mutex_unlock(&mutex);
+}
+
+// block until every queued task has finished
+void ThreadPool::wait()
+{
+  pthread_mutex_lock(&mutex);
+  while (pending > 0)
+    pthread_cond_wait(&done, &mutex);
+  pthread_mutex_unlock(&mutex);
+}
+
+int ThreadPool::size()
+{
+  return threads.size();
+}
+
+void *ThreadPool::worker(void *arg)
+{
+  ThreadPool *pool = (ThreadPool*)arg;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (true)
+  {
+    // wait for work
+    while (pool->queue.empty() && !pool->stopping)
+      pthread_cond_wait(&pool->ready, &pool->mutex);
+    if (pool->queue.empty()) break;
+
+    Task *task = pool->queue.front();
+    pool->queue.pop_front();
+
+    // run the task without holding the lock
+    pthread_mutex_unlock(&pool->mutex);
+    task->run();
+    pthread_mutex_lock(&pool->mutex);
+
+    if (--pool->pending == 0)
+      pthread_cond_broadcast(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
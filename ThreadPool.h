@@ -0,0 +1,52 @@
+/*
+   Copyright 2014 British Broadcasting Corporation
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+class ThreadPool
+{
+  public:
+
+    // a unit of work, owned by whoever adds it to the pool
+    class Task
+    {
+      public:
+        virtual ~Task() {}
+        virtual void run() = 0;
+    };
+
+    ThreadPool(int threads);
+    ~ThreadPool();
+    void add(Task *task);
+    void wait();
+    int size();
+
+  protected:
+    std::vector<pthread_t> threads;
+    std::deque<Task*> queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    pthread_cond_t done;
+    int pending;
+    bool stopping;
+    static void *worker(void *pool);
+};
+
+#endif
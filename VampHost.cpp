@@ -49,19 +49,44 @@
 */
 
 #include "VampHost.h"
+#include <pthread.h>
+#include <sstream>
+#include <sys/stat.h>
 
-VampHost::VampHost(SNDFILE *sndfile_in,
-             SF_INFO sfinfo,
+static pthread_mutex_t loaderMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// frames of a multichannel file mixed at a time for the peak analyser
+#define PEAKS_CHUNK 4096
+
+VampHost::VampHost(SF_INFO sfinfo,
              string soname,         // example: qm-vamp-plugins:qm-mfcc
              int blockSize_in,
-             int stepSize_in)
+             int stepSize_in,
+             int channel_in,
+             bool hostFFT)
 {
   useFrames = false;
-  sndfile = sndfile_in;
+  initialised = false;
+  plugin = NULL;
+  ring = NULL;
+  peaks = NULL;
+  fft = NULL;
+  framesIn = 0;
+  copiedBefore = 0;
+  shiftedBytes = 0;
+  channel = channel_in;
   sampleRate = sfinfo.samplerate;
-  channels = sfinfo.channels;
+  inputChannels = sfinfo.channels;
+  mixer = new ChannelMixer(inputChannels, channel);
+  channels = mixer->getOutputChannels();
   frames = sfinfo.frames;
 
+  // the host finds peaks itself
+  if (soname == PEAKS_PLUGIN) {
+    loadPeaks(blockSize_in, stepSize_in);
+    return;
+  }
+
   // parse plugin name
   string plugid = "";
   string::size_type sep = soname.find(':');
@@ -75,89 +100,189 @@ VampHost::VampHost(SNDFILE *sndfile_in,
     cerr << "Plugin not found!" << endl;
   }
 
+  // the loader isn't thread-safe, and hosts may be created on several
+  // threads in batch mode
+  pthread_mutex_lock(&loaderMutex);
+
   // initiate plugin loading
   PluginLoader *loader = PluginLoader::getInstance();
 
   // get key of selected plugin
   PluginLoader::PluginKey key = loader->composePluginKey(soname, plugid);
 
-  // load plugin with sample rate of .wav file
+  // load plugin with sample rate of .wav file. frequency domain plugins
+  // are loaded without the SDK's input domain adapter, so that the host
+  // can transform their blocks itself
   plugin = loader->loadPlugin
-      (key, sampleRate, PluginLoader::ADAPT_ALL_SAFE);
+      (key, sampleRate, PluginLoader::ADAPT_CHANNEL_COUNT);
+  pthread_mutex_unlock(&loaderMutex);
 
   // if plugin failed to load, throw error
   if (!plugin) {
     cerr << "ERROR: Failed to load plugin \"" << plugid
          << "\" from library \"" << soname << "\"" << endl;
-    exit(1);
+    return;
+  }
+
+  // set up block and step sizes
+  getFraming(blockSize_in, stepSize_in, &blockSize, &stepSize, true);
+
+  // the host's transform needs a power of two, so other block sizes are
+  // left to the adapter after all, as are plugins checked against it
+  if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
+    if (hostFFT && FFT::isPowerOfTwo(blockSize)) {
+      loadFFT();
+    } else {
+      pthread_mutex_lock(&loaderMutex);
+      delete plugin;
+      plugin = loader->loadPlugin
+          (key, sampleRate, PluginLoader::ADAPT_ALL_SAFE);
+      pthread_mutex_unlock(&loaderMutex);
+      if (!plugin) {
+        cerr << "ERROR: Failed to load plugin \"" << plugid
+             << "\" from library \"" << soname << "\"" << endl;
+        return;
+      }
+    }
+  }
+
+  // create buffer for framing blocks
+  ring = new RingBuffer(channels, blockSize);
+
+  // get list of outputs
+  outputs = plugin->getOutputDescriptors();
+
+  // check for no outputs, leaving the plugin unloaded so that one bad
+  // plugin fails only the files which use it
+  if (outputs.empty()) {
+    cerr << "ERROR: Plugin has no outputs!" << endl;
+    pthread_mutex_lock(&loaderMutex);
+    delete plugin;
+    pthread_mutex_unlock(&loaderMutex);
+    plugin = NULL;
+  }
+}
+
+VampHost::~VampHost()
+{
+  // clean up
+  delete ring;
+  delete mixer;
+  delete peaks;
+
+  // deleting the plugin may unload its library inside the loader
+  pthread_mutex_lock(&loaderMutex);
+  delete plugin;
+  pthread_mutex_unlock(&loaderMutex);
+  delete fft;
+}
+
+// set up the host's own transform of each block, with the same Hann window
+// as the SDK's input domain adapter
+void VampHost::loadFFT()
+{
+  fft = new FFT(blockSize);
+  window.resize(blockSize);
+  for (int i = 0; i < blockSize; ++i)
+    window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / blockSize);
+  windowed.resize(blockSize);
+  binsRe.resize(blockSize / 2 + 1);
+  binsIm.resize(blockSize / 2 + 1);
+  spectrumBuffer.resize(channels * (size_t)(blockSize + 2));
+  for (int c = 0; c < channels; ++c)
+    spectrum.push_back(&spectrumBuffer[c * (size_t)(blockSize + 2)]);
+}
+
+// set up the built-in peak analyser, which takes the peaks of each step on
+// its own, so the block is always the same as the step
+void VampHost::loadPeaks(int blockSize_in, int stepSize_in)
+{
+  getFraming(blockSize_in, stepSize_in, &blockSize, &stepSize);
+  if (blockSize_in != 0 && blockSize_in != stepSize) {
+    cerr << "WARNING: " << PEAKS_PLUGIN << " ignores blockSize "
+         << blockSize_in << ", using stepSize " << stepSize << endl;
+  }
+
+  peaks = new PeakAnalyser(channels, stepSize);
+
+  // a mono file is read straight from the decoded frames, anything else
+  // is mixed a chunk at a time
+  if (inputChannels > 1) {
+    mixBuffer.resize(channels * (size_t)PEAKS_CHUNK);
+    for (int c = 0; c < channels; ++c)
+      mixChannels.push_back(&mixBuffer[c * (size_t)PEAKS_CHUNK]);
+  }
+
+  Plugin::OutputDescriptor desc;
+  desc.identifier = "peaks";
+  desc.name = "Peaks";
+  desc.description = "Minimum of each channel, then maximum of each channel";
+  desc.unit = "";
+  desc.hasFixedBinCount = true;
+  desc.binCount = peaks->getBinCount();
+  desc.hasKnownExtents = false;
+  desc.isQuantized = false;
+  desc.sampleType = Plugin::OutputDescriptor::OneSamplePerStep;
+  desc.sampleRate = 0;
+  desc.hasDuration = false;
+  outputs.push_back(desc);
+}
+
+// the block and step sizes this plugin runs with when asked for the given
+// ones, where 0 leaves either to the plugin, so that requests can be
+// compared without loading another instance
+void VampHost::getFraming(int blockSize_in, int stepSize_in,
+                          int *block, int *step, bool warn)
+{
+  // the peak analyser takes the peaks of each step on its own
+  if (!plugin) {
+    *step = stepSize_in;
+    if (*step == 0) *step = blockSize_in;
+    if (*step == 0) *step = PEAKS_STEP;
+    *block = *step;
+    return;
   }
 
   // set up block size
-  blockSize = blockSize_in;
-  if (blockSize == 0) {
-    blockSize = plugin->getPreferredBlockSize();
+  *block = blockSize_in;
+  if (*block == 0) {
+    *block = plugin->getPreferredBlockSize();
   }
-  if (blockSize == 0) {
-    blockSize = 1024;
+  if (*block == 0) {
+    *block = 1024;
   }
 
   // set up step size
-  stepSize = stepSize_in;
-  if (stepSize == 0) {
-    stepSize = plugin->getPreferredStepSize();
+  *step = stepSize_in;
+  if (*step == 0) {
+    *step = plugin->getPreferredStepSize();
   }
 
   // if no preference given, set step size as half block
   // size if freq analysis, otherwise block size
-  if (stepSize == 0) {
+  if (*step == 0) {
     if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
-      stepSize = blockSize/2;
+      *step = *block/2;
     } else {
-      stepSize = blockSize;
+      *step = *block;
     }
   }
 
   // check step size is smaller or equal to block size
-  if (stepSize > blockSize) {
-    cerr << "WARNING: stepSize " << stepSize
-         << " > blockSize " << blockSize << ", resetting blockSize to ";
+  if (*step > *block) {
+    if (warn) cerr << "WARNING: stepSize " << *step
+         << " > blockSize " << *block << ", resetting blockSize to ";
     if (plugin->getInputDomain() == Plugin::FrequencyDomain) {
-      blockSize = stepSize * 2;
+      *block = *step * 2;
     } else {
-      blockSize = stepSize;
+      *block = *step;
     }
-    cerr << blockSize << endl;
+    if (warn) cerr << *block << endl;
   }
-
-  // create buffers for reading blocks
-  filebuf = new float[blockSize * channels];
-  plugbuf = new float*[channels];
-  for (int c = 0; c < channels; ++c) plugbuf[c] = new float[blockSize + 2];
-
-  // get list of outputs
-  Plugin::OutputList outputs = plugin->getOutputDescriptors();
-
-  // check for no outputs
-  if (outputs.empty()) {
-    cerr << "ERROR: Plugin has no outputs!" << endl;
-    exit(1);
-  }
-}
-
-VampHost::~VampHost()
-{
-  // clean up
-  delete[] filebuf;
-  for (int c = 0; c < channels; ++c) delete[] plugbuf[c];
-  delete[] plugbuf;
-  delete plugin;
 }
 
 int VampHost::findOutputNumber(string outputName)
 {
-  // get list of outputs
-  Plugin::OutputList outputs = plugin->getOutputDescriptors();
-
   // return position of output name in list
   for (size_t oi = 0; oi < outputs.size(); ++oi) {
     if (outputs[oi].identifier == outputName) {
@@ -171,107 +296,333 @@ int VampHost::findOutputNumber(string outputName)
   return -1;
 }
 
-int VampHost::run(Plugin::FeatureSet& results)
+int VampHost::run(AudioReader& reader, FeatureSink& sink)
 {
-    int overlapSize = blockSize - stepSize;
-    sf_count_t currentStep = 0;
-    // at end of file, this many part-silent frames needed after we hit EOF
-    int finalStepsRemaining = max(1, (blockSize / stepSize) - 1);
+    const float *frames;
+    int count;
+
+    if (initialise()) return 1;
+
+    // Here we iterate over the frames, avoiding asking the numframes
+    // in case it's streaming input.
+    while ((count = reader.read(&frames)) > 0) {
+        process(frames, count, sink);
+    }
+
+    // a decoding error is not the end of the file
+    if (count < 0) return 1;
+
+    return finish(sink);
+}
+
+// analyse the frames of a segment of the file
+//
+// the reader should be positioned at start, which must fall on the step
+// grid of a whole-file run. every block which begins before end is
+// processed, or the whole of the rest of the file if end is negative
+int VampHost::runSegment(AudioReader& reader, FeatureSink& sink,
+                         sf_count_t start, sf_count_t end)
+{
+    const float *frames;
+    int count = 0;
+
+    if (initialise(start)) return 1;
+
+    sf_count_t remaining = getSegmentFrames(start, end);
 
-    RealTime rt;
+    while (remaining != 0 && (count = reader.read(&frames)) > 0) {
+        if (remaining > 0 && count > remaining) count = remaining;
+        process(frames, count, sink);
+        if (remaining > 0) remaining -= count;
+    }
+    if (remaining != 0 && count < 0) return 1;
+
+    // pad the end of the file
+    if (remaining != 0) return finish(sink);
+
+    // or just collect whatever the plugin is holding back
+    if (peaks) return 0;
+    collectRemaining(sink);
+
+    return 0;
+}
+
+int VampHost::initialise(sf_count_t startFrame_in)
+{
     PluginWrapper *wrapper = 0;
-    RealTime adjustment = RealTime::zeroTime;
 
-    // initialise plugin
-    if (!plugin->initialise(channels, stepSize, blockSize)) {
+    startFrame = startFrame_in;
+    currentStep = 0;
+    lastStamp.clear();
+    framesIn = 0;
+    shiftedBytes = 0;
+    adjustment = RealTime::zeroTime;
+
+    if (peaks) {
+        peaks->reset(startFrame);
+        return 0;
+    }
+
+    ring->advance(ring->available());
+    copiedBefore = ring->getBytesCopied();
+
+    // initialise plugin, or return it to its initial state if it has been
+    // used before
+    if (initialised) {
+        plugin->reset();
+    } else if (!plugin->initialise(channels, stepSize, blockSize)) {
         cerr << "Plugin initialise (channels = " << channels
              << ", stepSize = " << stepSize << ", blockSize = "
              << blockSize << ") failed." << endl;
         return 1;
     }
+    initialised = true;
 
-    // find timestamp adjustment
+    // find timestamp adjustment. the host's own transform shifts the
+    // timestamps it gives the plugin to the centre of each block, as the
+    // adapter does
     wrapper = dynamic_cast<PluginWrapper *>(plugin);
-    if (wrapper) {
+    if (fft) {
+        adjustment = RealTime::frame2RealTime(blockSize / 2, sampleRate);
+    } else if (wrapper) {
         // See documentation for
         // PluginInputDomainAdapter::getTimestampAdjustment
         PluginInputDomainAdapter *ida =
             wrapper->getWrapper<PluginInputDomainAdapter>();
         if (ida) adjustment = ida->getTimestampAdjustment();
     }
-    
-    // Here we iterate over the frames, avoiding asking the numframes
-    // in case it's streaming input.
-    do {
 
-        int count;
+    // plugins sharing the spectra start at the same point
+    for (unsigned int f = 0; f < followers.size(); ++f)
+        if (followers[f]->initialise(startFrame)) return 1;
 
-        // if block size matches step size, just read a full block
-        if ((blockSize==stepSize) || (currentStep==0)) {
-            if ((count = sf_readf_float(sndfile, filebuf, blockSize)) < 0) {
-                cerr << "sf_readf_float failed: " << sf_strerror(sndfile)
-                  << endl;
-                break;
-            }
-            if (count != blockSize) --finalStepsRemaining;
+    return 0;
+}
 
-        // if different, shunt exiting data and read the remainder
-        } else {
-            memmove(filebuf, filebuf + (stepSize * channels),
-                    overlapSize * channels * sizeof(float));
-            if ((count = sf_readf_float(sndfile, filebuf + (overlapSize *
-                      channels), stepSize)) < 0) {
-                cerr << "sf_readf_float failed: " << sf_strerror(sndfile)
-                  << endl;
-                break;
-            }
-            if (count != stepSize) --finalStepsRemaining;
-            count += overlapSize;
-        }
+// feed a run of interleaved frames to the plugin
+//
+// frames may be supplied in chunks of any length, so that a single reader
+// can feed several hosts which each keep their own block/step framing
+int VampHost::process(const float *frames, int count, FeatureSink& sink)
+{
+    framesIn += count;
 
-        // copy data to plugin buffer
-        for (int c = 0; c < channels; ++c) {
-            int j = 0;
-            while (j < count) {
-                plugbuf[c][j] = filebuf[j * channels + c];
-                ++j;
-            }
-            while (j < blockSize) {
-                plugbuf[c][j] = 0.0f;
-                ++j;
-            }
+    if (peaks) {
+        processPeaks(frames, count, sink);
+        return 0;
+    }
+
+    while (count > 0) {
+
+        // top up the current block
+        int n = min(count, blockSize - ring->available());
+        mixer->mix(frames, n, ring->tail());
+        ring->commit(n);
+        frames += n * inputChannels;
+        count -= n;
+        shiftedBytes += (sf_count_t)n * channels * sizeof(float);
+
+        // once the block is full, process it and step past the oldest frames
+        if (ring->available() == blockSize) {
+            processBlock(sink);
+            ring->advance(stepSize);
+            shiftedBytes += (sf_count_t)(blockSize - stepSize) * channels *
+              sizeof(float);
         }
+    }
 
-        // show results
-        rt = RealTime::frame2RealTime(currentStep * stepSize, sampleRate);
-        Plugin::FeatureSet tmpResults = plugin->process(plugbuf, rt);
-        for(Plugin::FeatureSet::iterator it = tmpResults.begin();
-            it != tmpResults.end(); ++it)
-        {
-          int key = it->first;
-          Plugin::FeatureList feats = it->second;
-          for (unsigned int i=0; i<feats.size(); i++)
-            results[key].push_back(feats[i]);
+    return 0;
+}
+
+int VampHost::finish(FeatureSink& sink)
+{
+    // the built-in analyser has no need of padding
+    if (peaks) {
+        peaks->finish(sink, sampleRate);
+        return 0;
+    }
+
+    // at end of file, this many part-silent frames needed after we hit EOF
+    int finalStepsRemaining = max(1, (blockSize / stepSize) - 1);
+
+    // frames of audio left, which a shifted buffer would still move
+    int filled = ring->available();
+
+    while (finalStepsRemaining > 0) {
+        ring->silence(blockSize - ring->available());
+        processBlock(sink);
+        ring->advance(stepSize);
+        --finalStepsRemaining;
+        if (filled > stepSize) {
+            filled -= stepSize;
+            shiftedBytes += (sf_count_t)filled * channels * sizeof(float);
+        } else {
+            filled = 0;
         }
+    }
+
+    // show remaining results
+    collectRemaining(sink);
+
+    return 0;
+}
+
+// collect whatever this plugin and those sharing its spectra are holding
+// back at the end of a run
+void VampHost::collectRemaining(FeatureSink& sink)
+{
+    Plugin::FeatureSet tmpResults = plugin->getRemainingFeatures();
+    collect(tmpResults, sink, RealTime::frame2RealTime(startFrame +
+      currentStep * stepSize, sampleRate));
+
+    for (unsigned int f = 0; f < followers.size(); ++f)
+        followers[f]->collectRemaining(*followerSinks[f]);
+}
+
+// find the peaks of a run of interleaved frames without framing them into
+// blocks
+void VampHost::processPeaks(const float *frames, int count, FeatureSink& sink)
+{
+    if (inputChannels == 1) {
+        peaks->process(&frames, count, sink, sampleRate);
+        return;
+    }
+
+    while (count > 0) {
+        int n = min(count, PEAKS_CHUNK);
+        mixer->mix(frames, n, &mixChannels[0]);
+        peaks->process(&mixChannels[0], n, sink, sampleRate);
+        frames += n * inputChannels;
+        count -= n;
+    }
+}
+
+void VampHost::processBlock(FeatureSink& sink)
+{
+    // show results
+    RealTime rt = RealTime::frame2RealTime(startFrame +
+                                           currentStep * stepSize,
+                                           sampleRate);
+
+    // a shifted buffer de-interleaves each block for the plugin
+    shiftedBytes += (sf_count_t)blockSize * channels * sizeof(float);
+
+    if (fft) {
+        transform();
+        processSpectrum(&spectrum[0], rt, sink);
+    } else {
+        Plugin::FeatureSet tmpResults = plugin->process(ring->block(), rt);
+        collect(tmpResults, sink, rt);
 
         // count the steps
         ++currentStep;
+    }
+
+    // plugins sharing the spectra see the same block
+    for (unsigned int f = 0; f < followers.size(); ++f)
+        followers[f]->processSpectrum(&spectrum[0], rt, *followerSinks[f]);
+}
 
-    } while (finalStepsRemaining > 0);
+// window and transform each channel of the current block as the SDK's
+// input domain adapter would, swapping the halves of the block so that
+// phase is measured from its centre, and interleave the real and imaginary
+// parts of each bin from DC to Nyquist
+void VampHost::transform()
+{
+    float **block = ring->block();
+    int half = blockSize / 2;
+    for (int c = 0; c < channels; ++c) {
+        for (int i = 0; i < blockSize; ++i) {
+            int j = i < half ? i + half : i - half;
+            windowed[i] = block[c][j] * window[j];
+        }
+        fft->forward(&windowed[0], &binsRe[0], &binsIm[0]);
+        float *out = spectrum[c];
+        for (int k = 0; k <= half; ++k) {
+            out[2 * k] = (float)binsRe[k];
+            out[2 * k + 1] = (float)binsIm[k];
+        }
+    }
+}
 
-    // show remaining results
-    rt = RealTime::frame2RealTime(currentStep * stepSize, sampleRate);
-    Plugin::FeatureSet tmpResults = plugin->getRemainingFeatures();
-    for(Plugin::FeatureSet::iterator it = tmpResults.begin();
-        it != tmpResults.end(); ++it)
+// give the plugin the spectra of the block starting at rt
+void VampHost::processSpectrum(float **spectrum_in, RealTime rt,
+                               FeatureSink& sink)
+{
+    Plugin::FeatureSet tmpResults = plugin->process(spectrum_in,
+                                                    rt + adjustment);
+    collect(tmpResults, sink, rt);
+
+    // count the steps
+    ++currentStep;
+}
+
+// hand each output's features to the sink as soon as they are produced
+void VampHost::collect(Plugin::FeatureSet& features, FeatureSink& sink,
+                       RealTime rt)
+{
+    for(Plugin::FeatureSet::iterator it = features.begin();
+        it != features.end(); ++it)
     {
-      int key = it->first;
-      Plugin::FeatureList feats = it->second;
-      for (unsigned int i=0; i<feats.size(); i++)
-        results[key].push_back(feats[i]);
+      if (!sink.wants(it->first)) continue;
+      stampFeatures(it->first, it->second, rt);
+      sink.features(it->first, it->second);
     }
+}
 
-    return 0;
+// give features the timestamps that are implied when a plugin leaves them
+// out, so that every feature has a position and keeps it once segments are
+// stitched together
+void VampHost::stampFeatures(int output, Plugin::FeatureList& features,
+                             RealTime rt)
+{
+    Plugin::OutputDescriptor &desc = outputs[output];
+    for (unsigned int i=0; i<features.size(); i++)
+    {
+      Plugin::Feature &feature = features[i];
+      if (!feature.hasTimestamp) {
+        feature.hasTimestamp = true;
+        feature.timestamp = rt;
+
+        // fixed-rate features follow on from the previous one
+        if (desc.sampleType == Plugin::OutputDescriptor::FixedSampleRate &&
+            desc.sampleRate > 0 && lastStamp.count(output))
+          feature.timestamp = lastStamp[output] +
+            RealTime::fromSeconds(1.0 / desc.sampleRate);
+      }
+      lastStamp[output] = feature.timestamp;
+    }
+}
+
+// the frames runSegment() reads for a segment: up to the end of the last
+// block which begins before end, or -1 for the rest of the file
+sf_count_t VampHost::getSegmentFrames(sf_count_t start, sf_count_t end)
+{
+  if (end < 0) return -1;
+  return max((sf_count_t)0, end - start) + blockSize - stepSize;
+}
+
+// whether the plugin was loaded; if not, the host can't be used
+bool VampHost::isLoaded()
+{
+  return plugin != NULL || peaks != NULL;
+}
+
+// whether the plugin is fed from the host's transform rather than the
+// Vamp SDK's input domain adapter
+bool VampHost::usesHostFFT()
+{
+  return fft != NULL;
+}
+
+int VampHost::getSampleRate()
+{
+  return sampleRate;
+}
+
+int VampHost::getInputChannels()
+{
+  return inputChannels;
 }
 
 int VampHost::getBlockSize()
@@ -284,7 +635,81 @@ int VampHost::getStepSize()
   return stepSize;
 }
 
+// the library a plugin would be loaded from, with its size and time of
+// modification, which tells one version of the plugin from another without
+// loading it. empty if the library can't be found
+string VampHost::getLibraryStamp(string soname)
+{
+  ostringstream stamp;
+  if (soname == PEAKS_PLUGIN) {
+    stamp << PEAKS_PLUGIN << " " << PEAKS_VERSION;
+    return stamp.str();
+  }
+
+  string::size_type sep = soname.find(':');
+  if (sep == string::npos) return "";
+  pthread_mutex_lock(&loaderMutex);
+  PluginLoader *loader = PluginLoader::getInstance();
+  string path = loader->getLibraryPathForPlugin
+      (loader->composePluginKey(soname.substr(0, sep),
+                                soname.substr(sep + 1)));
+  pthread_mutex_unlock(&loaderMutex);
+
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st) != 0) return "";
+  stamp << path << " " << (long long)st.st_size << " "
+    << (long long)st.st_mtime;
+  return stamp.str();
+}
+
+// bytes copied into the plugin's buffers for each second of audio read
+// since the plugin was initialised
+double VampHost::getBytesCopiedPerSecond()
+{
+  if (framesIn == 0 || !ring) return 0;
+  return (ring->getBytesCopied() - copiedBefore) /
+    ((double)framesIn / sampleRate);
+}
+
+// bytes which the interleaved buffer that the ring replaced would have
+// copied for the same blocks: each frame copied in, the overlap moved to
+// the front after every step and each block de-interleaved for the plugin
+double VampHost::getShiftedBytesPerSecond()
+{
+  if (framesIn == 0 || !ring) return 0;
+  return shiftedBytes / ((double)framesIn / sampleRate);
+}
+
+// whether another frequency domain plugin can be given this one's spectra,
+// as it would transform the same blocks in the same way
+bool VampHost::canShareSpectra(VampHost& other)
+{
+  return this != &other && fft && other.fft && other.followers.empty() &&
+    sampleRate == other.sampleRate && inputChannels == other.inputChannels &&
+    (inputChannels == 1 || channel == other.channel) &&
+    blockSize == other.blockSize && stepSize == other.stepSize;
+}
+
+// feed another plugin from this one's spectra for the rest of its runs,
+// sending its features to its own sink
+void VampHost::shareSpectra(VampHost *follower, FeatureSink *sink)
+{
+  followers.push_back(follower);
+  followerSinks.push_back(sink);
+}
+
+void VampHost::clearFollowers()
+{
+  followers.clear();
+  followerSinks.clear();
+}
+
 void VampHost::setParameter(string name, float value)
 {
+  if (peaks) {
+    cerr << "WARNING: " << PEAKS_PLUGIN << " has no parameter \"" << name
+         << "\"" << endl;
+    return;
+  }
   plugin->setParameter(name, value);
 }
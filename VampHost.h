@@ -56,6 +56,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <set>
 #include <sndfile.h>
 #include <vector>
@@ -64,6 +65,12 @@
 #include <cstdlib>
 
 #include "system.h"
+#include "AudioReader.h"
+#include "RingBuffer.h"
+#include "FeatureSink.h"
+#include "ChannelMixer.h"
+#include "PeakAnalyser.h"
+#include "FFT.h"
 
 #include <cmath>
 
@@ -82,7 +89,6 @@ class VampHost
 {
   protected:
     Plugin *plugin;
-    SNDFILE *sndfile;
     sf_count_t frames;
     int blockSize;
     int stepSize;
@@ -90,20 +96,74 @@ class VampHost
     int channels;
     int outputNo;
     bool useFrames;
-    float *filebuf;
-    float **plugbuf;
+    int inputChannels;
+    ChannelMixer *mixer;
+    RingBuffer *ring;
+    sf_count_t startFrame;
+    sf_count_t currentStep;
+    sf_count_t framesIn;
+    sf_count_t copiedBefore;  // bytes the ring had copied at initialise()
+    sf_count_t shiftedBytes;  // bytes a shifted buffer would have copied
+    RealTime adjustment;
+    Plugin::OutputList outputs;
+    map<int, RealTime> lastStamp;
+    bool initialised;
+    PeakAnalyser *peaks;
+    vector<float> mixBuffer;
+    vector<float*> mixChannels;
+    int channel;
+    FFT *fft;                 // transforms the blocks of a frequency domain
+                              // plugin in place of the SDK's adapter
+    vector<double> window;
+    vector<double> windowed;
+    vector<double> binsRe;
+    vector<double> binsIm;
+    vector<float> spectrumBuffer;
+    vector<float*> spectrum;
+    vector<VampHost*> followers;        // plugins fed from these spectra
+    vector<FeatureSink*> followerSinks;
+    void loadFFT();
+    void transform();
+    void processSpectrum(float **spectrum, RealTime rt, FeatureSink& sink);
+    void collectRemaining(FeatureSink& sink);
+    void loadPeaks(int blockSize, int stepSize);
+    void processPeaks(const float *frames, int count, FeatureSink& sink);
+    void stampFeatures(int output, Plugin::FeatureList& features,
+                       RealTime rt);
+    void processBlock(FeatureSink& sink);
+    void collect(Plugin::FeatureSet& features, FeatureSink& sink,
+                 RealTime rt);
 
   public:
-    VampHost(SNDFILE *sndfile,
-             SF_INFO sfinfo,
+    VampHost(SF_INFO sfinfo,
              string soname,         // example: qm-vamp-plugins:qm-mfcc
              int blockSize=0,
-             int stepSize=0);
+             int stepSize=0,
+             int channel=VAMP_DOWNMIX,
+             bool hostFFT=true);
     ~VampHost();
-    int run(Plugin::FeatureSet& results);
+    int run(AudioReader& reader, FeatureSink& sink);
+    int runSegment(AudioReader& reader, FeatureSink& sink,
+                   sf_count_t start, sf_count_t end);
+    sf_count_t getSegmentFrames(sf_count_t start, sf_count_t end);
+    int initialise(sf_count_t startFrame=0);
+    int process(const float *frames, int count, FeatureSink& sink);
+    int finish(FeatureSink& sink);
     int findOutputNumber(string outputName);
+    bool isLoaded();
+    bool usesHostFFT();
+    int getSampleRate();
+    int getInputChannels();
     int getBlockSize();
     int getStepSize();
+    void getFraming(int blockSize, int stepSize, int *block, int *step,
+                    bool warn=false);
+    static string getLibraryStamp(string soname);
+    double getBytesCopiedPerSecond();
+    double getShiftedBytesPerSecond();
     void setParameter(string name, float value);
+    bool canShareSpectra(VampHost& other);
+    void shareSpectra(VampHost *follower, FeatureSink *sink);
+    void clearFollowers();
 };
 #endif
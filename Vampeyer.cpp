@@ -18,11 +18,18 @@
 #include "VampHost.h"
 #include "GUI.h"
 #include "PNGWriter.h"
+#include "ImageWriter.h"
+#include "Batch.h"
+#include "Daemon.h"
+#include <algorithm>
 #include <iostream>
 #include <dlfcn.h>
 #include <sstream>
 #include <string>
 #include <sndfile.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
 #include <tclap/CmdLine.h>
 
 #define BYTES_PER_PIXEL 4
@@ -33,57 +40,407 @@ using std::endl;
 using std::string;
 using std::flush;
 using std::istringstream;
+using std::vector;
+using std::find;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// encode the image repeatedly for a steady figure, printing its size and
+// speed
+static bool timeEncode(ImageWriter &writer, double megabytes)
+{
+  vector<unsigned char> bytes;
+  int runs = 0;
+  double start = now(), elapsed = 0;
+  do {
+    bytes.clear();
+    if (writer.write(bytes)) return false;
+    runs++;
+    elapsed = now() - start;
+  } while (elapsed < 0.5);
+
+  cout << bytes.size() << " " << (int)(megabytes * runs / elapsed) << endl;
+  return true;
+}
+
+// encode the image with a range of PNG settings and in the other formats,
+// printing the size and speed of each
+static void benchmarkImage(int width, int height, unsigned char *buffer,
+                           int threads, bool rgba)
+{
+  struct Setting { int level; int filters; int strategy; };
+  static const Setting settings[] = {
+    { 1, PNG_FILTER_NONE, -1 }, { 1, PNG_ALL_FILTERS, -1 },
+    { 6, PNG_FILTER_NONE, -1 }, { 6, PNG_FILTER_UP, -1 },
+    { 6, PNG_ALL_FILTERS, -1 }, { 6, PNG_ALL_FILTERS, Z_HUFFMAN_ONLY },
+    { 6, PNG_ALL_FILTERS, Z_RLE }, { 9, PNG_FILTER_NONE, -1 },
+    { 9, PNG_ALL_FILTERS, -1 } };
+  double megabytes = (double)width * height * BYTES_PER_PIXEL / 1e6;
+
+  cout << "format level filters strategy threads bytes MB/s" << endl;
+  for (unsigned int s = 0; s < sizeof(settings) / sizeof(settings[0]); s++)
+  {
+    // on one thread and on all of them
+    for (int t = 1; t <= threads; t = (t == 1 ? std::max(2, threads) :
+         threads + 1))
+    {
+      PNGOptions options;
+      options.level = settings[s].level;
+      options.filters = settings[s].filters;
+      options.strategy = settings[s].strategy;
+      options.threads = t;
+      options.rgba = rgba;
+      PNGWriter writer(width, height, buffer, options);
+
+      cout << "png " << options.level << " "
+        << (options.filters == PNG_ALL_FILTERS ? "all" :
+            options.filters == PNG_FILTER_UP ? "up" : "none") << " "
+        << (options.strategy == Z_HUFFMAN_ONLY ? "huffman" :
+            options.strategy == Z_RLE ? "rle" : "default") << " "
+        << t << " " << flush;
+      if (!timeEncode(writer, megabytes)) return;
+    }
+  }
+
+  static const int formats[] = { IMAGE_QOI, IMAGE_PAM, IMAGE_RAW };
+  static const char *names[] = { "qoi", "pam", "raw" };
+  for (int f = 0; f < 3; f++)
+  {
+    ImageWriter *writer = ImageWriter::create(formats[f], width, height,
+                                              buffer, PNGOptions());
+    cout << names[f] << " - - - 1 " << flush;
+    bool ok = timeEncode(*writer, megabytes);
+    delete writer;
+    if (!ok) return;
+  }
+}
 
 int main(int argc, char** argv)
 {
-  bool verbose;
+  bool verbose, singlePass, explain, fftCheck;
   string pngfile, visPluginPath, wavfile, size;
-  int width=0, height=0;
+  vector<string> visPluginPaths;
+  int width=0, height=0, jobs=1, shards=1;
+  vector<int> widths, heights;
+  vector<string> pngfiles;
+  double shardOverlap=1.0;
+  int readAhead=DECODE_AHEAD_BLOCKS;
+  string cacheDir, manifest, socketPath, outputDir, pyramidPath, range;
+  string pngFilter, pngStrategy, format;
+  int imageFormat=IMAGE_AUTO;
+  PNGOptions png;
+  bool pngBenchmark;
+  double rangeStart=0, rangeEnd=0;
+  int queueSize=64;
+  int cacheSize=1024;
 
   // parse command line arguments
   try
   {
     TCLAP::CmdLine cmd("Audio visualiser", ' ', "0.1");
     TCLAP::UnlabeledValueArg<string> wavFileArg("wavFile",
-        "Path of audio file", true, "", "filename.wav");
-    TCLAP::ValueArg<string> visPluginArg("p", "plugin",
-        "Path of visualization plugin", true, "", "library.so");
+        "Path of audio file", false, "", "filename.wav");
+    TCLAP::MultiArg<string> visPluginArg("p", "plugin",
+        "Path of visualization plugin, given again for each visualization "
+        "to draw from the same analysis", true, "library.so");
     TCLAP::ValueArg<string> pngFileArg("o", "pngFile",
-        "File to save output PNG", false, "", "filename.png");
+        "File to save output image, or - for standard output, with one "
+        "comma-separated name for each size of each plugin", false, "",
+        "filename.png");
+    TCLAP::ValueArg<string> formatArg("f", "format",
+        "Format of output image, if not the output file's extension",
+        false, "", "png|raw|ppm|pam|qoi");
     TCLAP::ValueArg<string> sizeArg("s", "size",
-        "Size of output image in pixels", false, "600x200",
+        "Size of output image in pixels, or a comma-separated list of "
+        "sizes to render from the same analysis", false, "600x200",
         "width>x<height");
     TCLAP::SwitchArg verboseArg("V", "verbose", "Enable verbose output",
         false);
+    TCLAP::SwitchArg explainArg("", "explain",
+        "Print how the audio will be analysed before analysing it", false);
+    TCLAP::SwitchArg singlePassArg("1", "single-pass",
+        "Decode the audio once for all Vamp plugins", false);
+    TCLAP::ValueArg<int> jobsArg("j", "jobs",
+        "Number of Vamp plugins to run concurrently", false, 1, "N");
+    TCLAP::ValueArg<int> shardsArg("", "shards",
+        "Number of time segments to analyse in parallel", false, 1, "N");
+    TCLAP::ValueArg<double> shardOverlapArg("", "shard-overlap",
+        "Seconds of audio used to warm up each segment", false, 1.0,
+        "seconds");
+    TCLAP::ValueArg<int> readAheadArg("", "decode-ahead",
+        "Number of blocks to decode on a separate thread ahead of the Vamp "
+        "plugins, or 0 to decode on the same thread", false,
+        DECODE_AHEAD_BLOCKS, "N");
+    TCLAP::ValueArg<string> cacheDirArg("", "cache-dir",
+        "Directory in which to cache Vamp plugin features", false, "",
+        "directory");
+    TCLAP::ValueArg<string> batchArg("b", "batch",
+        "Render every job listed in a manifest of input, output and size",
+        false, "", "manifest");
+    TCLAP::ValueArg<string> daemonArg("", "daemon",
+        "Serve render requests on a Unix domain socket", false, "",
+        "socket");
+    TCLAP::ValueArg<string> outputDirArg("", "output-dir",
+        "Directory in which the daemon may write the outputs requests name",
+        false, "", "directory");
+    TCLAP::ValueArg<int> queueArg("", "queue",
+        "Number of daemon requests which can wait for a worker", false, 64,
+        "N");
+    TCLAP::ValueArg<int> cacheSizeArg("", "cache-size",
+        "Size limit of the feature cache in megabytes", false, 1024, "MB");
+    TCLAP::ValueArg<string> pyramidArg("", "pyramid",
+        "File of peaks to draw from, written first if need be", false, "",
+        "filename");
+    TCLAP::ValueArg<string> rangeArg("", "range",
+        "Time range of the audio to draw in seconds", false, "",
+        "start>:<end");
+    TCLAP::ValueArg<int> pngLevelArg("", "png-level",
+        "zlib compression level of the PNG", false, -1, "0-9");
+    TCLAP::ValueArg<string> pngFilterArg("", "png-filter",
+        "PNG row filters to choose from", false, "",
+        "none|sub|up|avg|paeth|all,...");
+    TCLAP::ValueArg<string> pngStrategyArg("", "png-strategy",
+        "zlib compression strategy of the PNG", false, "",
+        "default|filtered|huffman|rle|fixed");
+    TCLAP::ValueArg<int> pngThreadsArg("", "png-threads",
+        "Number of threads to compress the PNG with", false, 1, "N");
+    TCLAP::SwitchArg pngRGBAArg("", "png-rgba",
+        "Write RGBA pixels rather than the smallest format that fits", false);
+    TCLAP::SwitchArg fftCheckArg("", "fft-check",
+        "Compare the features of frequency-domain Vamp plugins fed from the "
+        "host's FFT with those from the Vamp SDK's adapter", false);
+    TCLAP::SwitchArg pngBenchmarkArg("", "png-benchmark",
+        "Report the size and speed of PNG compression settings and of the "
+        "other image formats", false);
 
     cmd.add(wavFileArg);
     cmd.add(visPluginArg);
     cmd.add(pngFileArg);
+    cmd.add(formatArg);
     cmd.add(sizeArg);
     cmd.add(verboseArg);
+    cmd.add(explainArg);
+    cmd.add(singlePassArg);
+    cmd.add(jobsArg);
+    cmd.add(shardsArg);
+    cmd.add(shardOverlapArg);
+    cmd.add(readAheadArg);
+    cmd.add(cacheDirArg);
+    cmd.add(cacheSizeArg);
+    cmd.add(batchArg);
+    cmd.add(daemonArg);
+    cmd.add(outputDirArg);
+    cmd.add(queueArg);
+    cmd.add(pyramidArg);
+    cmd.add(rangeArg);
+    cmd.add(pngLevelArg);
+    cmd.add(pngFilterArg);
+    cmd.add(pngStrategyArg);
+    cmd.add(pngThreadsArg);
+    cmd.add(pngRGBAArg);
+    cmd.add(pngBenchmarkArg);
+    cmd.add(fftCheckArg);
 
     // parse arguments
     cmd.parse(argc, argv);
     wavfile = wavFileArg.getValue();
-    visPluginPath = visPluginArg.getValue();
+    visPluginPaths = visPluginArg.getValue();
+    visPluginPath = visPluginPaths[0];
     pngfile = pngFileArg.getValue();
+    format = formatArg.getValue();
     size = sizeArg.getValue();
     verbose = verboseArg.getValue();
+    explain = explainArg.getValue();
+    singlePass = singlePassArg.getValue();
+    jobs = jobsArg.getValue();
+    shards = shardsArg.getValue();
+    shardOverlap = shardOverlapArg.getValue();
+    readAhead = readAheadArg.getValue();
+    cacheDir = cacheDirArg.getValue();
+    cacheSize = cacheSizeArg.getValue();
+    manifest = batchArg.getValue();
+    socketPath = daemonArg.getValue();
+    outputDir = outputDirArg.getValue();
+    queueSize = queueArg.getValue();
+    pyramidPath = pyramidArg.getValue();
+    range = rangeArg.getValue();
+    png.level = pngLevelArg.getValue();
+    pngFilter = pngFilterArg.getValue();
+    pngStrategy = pngStrategyArg.getValue();
+    png.threads = pngThreadsArg.getValue();
+    png.rgba = pngRGBAArg.getValue();
+    pngBenchmark = pngBenchmarkArg.getValue();
+    fftCheck = fftCheckArg.getValue();
+
+    // check there is something to render
+    if (wavfile == "" && manifest == "" && socketPath == "")
+    {
+      cerr << "ERROR: An audio file, batch manifest or daemon socket is "
+        << "required." << endl;
+      return 1;
+    }
 
-    // parse size
-    istringstream ss(size);
-    string widthStr, heightStr;
-    getline( ss, widthStr, 'x' );
-    getline( ss, heightStr );
-    istringstream(widthStr) >> width;
-    istringstream(heightStr) >> height;
+    // a pyramid holds the peaks of one audio file
+    if (pyramidPath != "" && wavfile == "")
+    {
+      cerr << "ERROR: A peak pyramid can only be used with a single audio "
+        << "file." << endl;
+      return 1;
+    }
 
-    // check size is valid 
-    if (width <= 0 || height <= 0)
+    // parse range, where a missing end means the end of the audio
+    if (range != "")
+    {
+      istringstream rs(range);
+      string startStr, endStr;
+      getline( rs, startStr, ':' );
+      getline( rs, endStr );
+      bool ok = startStr == "" || (istringstream(startStr) >> rangeStart);
+      if (endStr != "") ok = ok && (istringstream(endStr) >> rangeEnd);
+      if (!ok || rangeStart < 0 || rangeEnd < 0 ||
+          (rangeEnd > 0 && rangeEnd <= rangeStart))
+      {
+        cerr << "ERROR: Could not parse range argument." << endl;
+        return 1;
+      }
+    }
+
+    // check queue size is valid
+    if (queueSize < 1)
+    {
+      cerr << "ERROR: Queue size must be at least 1." << endl;
+      return 1;
+    }
+
+    // parse sizes
+    istringstream sizes(size);
+    string sizeStr;
+    while (getline( sizes, sizeStr, ',' ))
+    {
+      istringstream ss(sizeStr);
+      string widthStr, heightStr;
+      getline( ss, widthStr, 'x' );
+      getline( ss, heightStr );
+      width = height = 0;
+      istringstream(widthStr) >> width;
+      istringstream(heightStr) >> height;
+
+      // check size is valid 
+      if (width <= 0 || height <= 0)
+      {
+        cerr << "ERROR: Could not parse size argument." << endl;
+        return 1;
+      }
+      widths.push_back(width);
+      heights.push_back(height);
+    }
+    if (widths.empty())
     {
       cerr << "ERROR: Could not parse size argument." << endl;
       return 1;
     }
+    width = widths[0];
+    height = heights[0];
+
+    // the daemon only writes outputs into its own directory
+    if (outputDir != "" && socketPath == "")
+    {
+      cerr << "ERROR: An output directory can only be used by the daemon."
+        << endl;
+      return 1;
+    }
+
+    // several plugins or sizes are only rendered from a single audio file,
+    // into a file for each size of each plugin in turn, except that the
+    // daemon only loads the plugins it is given, the first of which requests
+    // use unless they name another
+    if ((visPluginPaths.size() > 1 && socketPath == "") || widths.size() > 1)
+    {
+      istringstream names(pngfile);
+      string name;
+      while (getline( names, name, ',' )) pngfiles.push_back(name);
+      if (wavfile == "" || manifest != "" || socketPath != "")
+      {
+        cerr << "ERROR: Several plugins or sizes can only be rendered from "
+          << "a single audio file." << endl;
+        return 1;
+      }
+      if (pngfiles.size() != visPluginPaths.size() * widths.size() &&
+          !pngBenchmark)
+      {
+        cerr << "ERROR: An output file is needed for each size of each "
+          << "plugin." << endl;
+        return 1;
+      }
+    }
+    else if (pngfile != "")
+      pngfiles.push_back(pngfile);
+
+    // check number of jobs is valid
+    if (jobs < 1)
+    {
+      cerr << "ERROR: Number of jobs must be at least 1." << endl;
+      return 1;
+    }
+
+    // check number of blocks to decode ahead is valid
+    if (readAhead < 0)
+    {
+      cerr << "ERROR: Number of blocks to decode ahead can't be negative."
+        << endl;
+      return 1;
+    }
+
+    // check sharding is valid
+    if (shards < 1 || shardOverlap < 0)
+    {
+      cerr << "ERROR: Could not parse shard arguments." << endl;
+      return 1;
+    }
+
+    // check cache size is valid
+    if (cacheSize < 1)
+    {
+      cerr << "ERROR: Cache size must be at least 1MB." << endl;
+      return 1;
+    }
+
+    // parse image format
+    if (format != "")
+    {
+      imageFormat = ImageWriter::parseFormat(format);
+      if (imageFormat < 0)
+      {
+        cerr << "ERROR: Unknown image format \"" << format << "\"." << endl;
+        return 1;
+      }
+    }
+
+    // progress and reports are written to standard output, so it can't be
+    // used for the image as well
+    if ((verbose || explain || fftCheck) &&
+        find(pngfiles.begin(), pngfiles.end(), "-") != pngfiles.end())
+    {
+      cerr << "ERROR: Verbose output, --explain and --fft-check can't be "
+        << "used when writing the image to standard output." << endl;
+      return 1;
+    }
+
+    // parse PNG compression settings
+    if (pngFilter != "") png.filters = PNGWriter::parseFilters(pngFilter);
+    if (pngStrategy != "") png.strategy = PNGWriter::parseStrategy(pngStrategy);
+    if (png.level < -1 || png.level > 9 || png.threads < 1 ||
+        (pngFilter != "" && png.filters < 0) ||
+        (pngStrategy != "" && png.strategy < 0))
+    {
+      cerr << "ERROR: Could not parse PNG arguments." << endl;
+      return 1;
+    }
 
   } catch (TCLAP::ArgException &e)
   {
@@ -91,12 +448,69 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  // declare plugin and buffer space
-  unsigned char* buffer = new unsigned char[width*height*BYTES_PER_PIXEL];
+  // in batch and daemon modes, render each file with the same settings,
+  // using the jobs argument as the number of files to render at once
+  VisHost settings(visPluginPath);
+  settings.verbose = verbose;
+  settings.explainPlan = explain;
+  settings.checkFFT = fftCheck;
+  settings.singlePass = singlePass;
+  settings.shards = shards;
+  settings.shardOverlap = shardOverlap;
+  settings.readAhead = readAhead;
+  settings.cacheDir = cacheDir;
+  settings.cacheSize = (off_t)cacheSize << 20;
+  settings.rangeStart = rangeStart;
+  settings.rangeEnd = rangeEnd;
+  settings.png = png;
+  settings.imageFormat = imageFormat;
+  if (manifest != "")
+  {
+    Batch batch(visPluginPath, settings);
+    if (batch.load(manifest, width, height)) return 1;
+    return batch.run(jobs);
+  }
+  if (socketPath != "")
+  {
+    Daemon daemon(socketPath, visPluginPaths, outputDir, settings, width,
+                  height, queueSize);
+    return daemon.run(jobs);
+  }
+
+  // declare plugins and buffer space for each size of each
+  vector<RenderTarget> targets;
+  for (unsigned int p = 0; p < visPluginPaths.size(); p++)
+  {
+    for (unsigned int i = 0; i < widths.size(); i++)
+    {
+      RenderTarget target;
+      target.width = widths[i];
+      target.height = heights[i];
+      target.buffer = new unsigned char[widths[i]*heights[i]*BYTES_PER_PIXEL];
+      target.plugin = p;
+      targets.push_back(target);
+    }
+  }
+  unsigned char* buffer = targets[0].buffer;
   VisHost visHost(visPluginPath);
+  for (unsigned int p = 1; p < visPluginPaths.size(); p++)
+    visHost.addPlugin(visPluginPaths[p]);
 
   // set verbosity level
   visHost.verbose = verbose;
+  visHost.explainPlan = explain;
+  visHost.checkFFT = fftCheck;
+  visHost.singlePass = singlePass;
+  visHost.jobs = jobs;
+  visHost.shards = shards;
+  visHost.shardOverlap = shardOverlap;
+  visHost.readAhead = readAhead;
+  visHost.cacheDir = cacheDir;
+  visHost.cacheSize = (off_t)cacheSize << 20;
+  visHost.pyramidPath = pyramidPath;
+  visHost.rangeStart = rangeStart;
+  visHost.rangeEnd = rangeEnd;
+  visHost.png = png;
 
   // initialise plugin 
   if (visHost.init()) {
@@ -110,19 +524,39 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  // draw visualisation
-  if (visHost.render(width, height, buffer)) {
+  // draw every visualisation at every size
+  if (visHost.render(targets)) {
     cerr << "ERROR: Could not render visualisation." << endl;
     return 1;
   }
 
-  if (pngfile != "")
+  // compare compression settings on the image, with as many threads as
+  // there are processors unless told otherwise
+  if (pngBenchmark)
   {
-    if (verbose) cout << " * Writing PNG..." << flush;
-    PNGWriter pngWriter(width, height, buffer);
-    if (pngWriter.write(pngfile.c_str())) {
-      cerr << "ERROR: Failed to write PNG." << endl;
-      return 1;
+    int threads = png.threads > 1 ? png.threads :
+      std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    benchmarkImage(width, height, buffer, threads, png.rgba);
+    return 0;
+  }
+
+  if (!pngfiles.empty())
+  {
+    if (verbose) cout << " * Writing image..." << flush;
+    for (unsigned int i = 0; i < targets.size(); i++)
+    {
+      int fileFormat = imageFormat;
+      if (fileFormat == IMAGE_AUTO)
+        fileFormat = ImageWriter::formatOf(pngfiles[i]);
+      ImageWriter *writer = ImageWriter::create(fileFormat, targets[i].width,
+                                                targets[i].height,
+                                                targets[i].buffer, png);
+      int status = writer->write(pngfiles[i].c_str());
+      delete writer;
+      if (status) {
+        cerr << "ERROR: Failed to write image." << endl;
+        return 1;
+      }
     }
     if (verbose) cout << " [done]" << endl;
   }
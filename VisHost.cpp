@@ -14,19 +14,240 @@
    limitations under the License.
 */
 #include "VisHost.h"
+#include <algorithm>
+#include <sstream>
+
+// resample a reader to the rate a plugin asks for, if it differs from the
+// file's rate
+static AudioReader *resample(AudioReader *reader,
+                             VisPlugin::VampPlugin plugin, SF_INFO sfinfo)
+{
+  if (plugin.targetSampleRate <= 0 ||
+      plugin.targetSampleRate == sfinfo.samplerate) return reader;
+  return new ResamplingReader(*reader, sfinfo.channels, sfinfo.samplerate,
+                              plugin.targetSampleRate);
+}
+
+// decode the blocks of a reader on a thread of their own, ahead of the
+// plugin reading them, unless they are read straight from memory with no
+// work to overlap. a limit stops decoding after that many frames
+static AudioReader *decodeAhead(AudioReader *input, int channels,
+                                int blocks, sf_count_t limit=-1)
+{
+  if (blocks < 1 || input->isMapped()) return input;
+  DecodeAheadReader *ahead = new DecodeAheadReader(*input, channels, blocks);
+  ahead->setLimit(limit);
+  return ahead;
+}
+
+// the interface as plugins built before abi_version() was exported see it,
+// whose requests for Vamp plugins lack the fields added to VampPlugin since.
+// its virtual functions are in the same order as VisPlugin's first ones
+class VisPluginV1
+{
+  protected:
+    int width;
+    int height;
+
+  public:
+    typedef struct _VampPlugin
+    {
+      const char *name;
+      int blockSize;
+      int stepSize;
+      VisPlugin::VampParameterList parameters;
+    } VampPlugin;
+
+    typedef struct _VampOutput
+    {
+      VampPlugin plugin;
+      const char *name;
+    } VampOutput;
+
+    typedef std::vector<VampOutput> VampOutputList;
+
+    virtual ~VisPluginV1() {}
+    virtual int ARGB(Plugin::FeatureSet features, int width, int height,
+                     unsigned char *bitmap, int sampleRate) = 0;
+    virtual VampOutputList getVampPlugins() = 0;
+    virtual double getVersion() const = 0;
+};
+
+// runs the whole file through one Vamp plugin
+class RunTask : public ThreadPool::Task
+{
+  public:
+    VisPlugin::VampPlugin plugin;
+    VampHost *host;
+    FeatureSink *sink;
+    AudioSource source;
+    int readAhead;
+    int status;
+
+    RunTask(VisPlugin::VampPlugin plugin_in, VampHost *host_in,
+            FeatureSink *sink_in, const AudioSource &source_in,
+            int readAhead_in)
+      : plugin(plugin_in), host(host_in), sink(sink_in), source(source_in),
+        readAhead(readAhead_in), status(0) {}
+
+    // read from a private reader of the audio
+    void run() {
+      SF_INFO sfinfo;
+      AudioReader *reader = source.open(&sfinfo);
+      if (!reader) {
+        status = 1;
+        return;
+      }
+      AudioReader *input = resample(reader, plugin, sfinfo);
+      AudioReader *ahead = decodeAhead(input, sfinfo.channels, readAhead);
+      status = host->run(*ahead, *sink);
+      if (ahead != input) delete ahead;
+      if (input != reader) delete input;
+      delete reader;
+    }
+};
+
+// runs one time segment of the file through its own plugin instance
+class ShardTask : public ThreadPool::Task
+{
+  public:
+    VisPlugin::VampPlugin plugin;
+    VampHost *host;
+    SegmentSink *sink;
+    AudioSource source;
+    sf_count_t from;
+    sf_count_t end;
+    int readAhead;
+    int status;
+
+    ShardTask(VisPlugin::VampPlugin plugin_in, VampHost *host_in,
+              SegmentSink *sink_in, const AudioSource &source_in,
+              sf_count_t from_in, sf_count_t end_in, int readAhead_in)
+      : plugin(plugin_in), host(host_in), sink(sink_in), source(source_in),
+        from(from_in), end(end_in), readAhead(readAhead_in), status(0) {}
+
+    ~ShardTask() {
+      delete sink;
+    }
+
+    // read from a private reader of the audio
+    void run() {
+      if (!host) {
+        status = 1;
+        return;
+      }
+      SF_INFO sfinfo;
+      AudioReader *reader = source.open(&sfinfo);
+      if (!reader) {
+        status = 1;
+        return;
+      }
+      // decode no further than the end of the segment's last block
+      AudioReader *input = resample(reader, plugin, sfinfo);
+      AudioReader *ahead = decodeAhead(input, sfinfo.channels, readAhead,
+                                       host->getSegmentFrames(from, end));
+      status = ahead->seek(from) || host->runSegment(*ahead, *sink, from, end);
+      if (ahead != input) delete ahead;
+      if (input != reader) delete input;
+      delete reader;
+    }
+};
+
+// a block of the audio at one analysis rate
+struct Stream
+{
+  Resampler *resampler;
+  const float *frames;
+  int count;
+};
+
+// feeds one decoded block to one Vamp plugin
+class BlockTask : public ThreadPool::Task
+{
+  public:
+    VampHost *host;
+    FeatureSink *sink;
+    int rate;
+    const float *frames;
+    int count;
+
+    BlockTask(VampHost *host_in, FeatureSink *sink_in, int rate_in)
+      : host(host_in), sink(sink_in), rate(rate_in), frames(NULL), count(0) {}
+
+    void run() {
+      host->process(frames, count, *sink);
+    }
+};
+
+// renders images one after another
+class RenderTask : public ThreadPool::Task
+{
+  public:
+    const VisHost *host;
+    vector<RenderTarget> targets;
+    int status;
+
+    RenderTask(const VisHost *host_in) : host(host_in), status(0) {}
+
+    void run() {
+      for (unsigned int t=0; t<targets.size() && !status; t++)
+        status = host->draw(targets[t].plugin, targets[t].width,
+                            targets[t].height, targets[t].buffer);
+    }
+};
 
 VisHost::VisHost(string pluginPath_in)
 {
   // set the location of the visualization library
-  pluginPath = pluginPath_in;
+  addPlugin(pluginPath_in);
+  reader=NULL;
   verbose=false;
+  singlePass=false;
+  jobs=1;
+  shards=1;
+  shardOverlap=1.0;
+  cacheSize=(off_t)1 << 30;
+  cache=NULL;
+  pyramid=NULL;
+  explainPlan=false;
+  checkFFT=false;
+  readAhead=DECODE_AHEAD_BLOCKS;
+  rangeStart=0;
+  rangeEnd=0;
+  imageFormat=IMAGE_AUTO;
+}
+
+// draw another visualization from the same analysis, loaded by init()
+void VisHost::addPlugin(string pluginPath)
+{
+  VisLibrary vis;
+  vis.path = pluginPath;
+  vis.handle = NULL;
+  vis.destroy_plugin = NULL;
+  vis.plugin = NULL;
+  vis.abiVersion = 1;
+  vis.firstOutput = 0;
+  vis.outputs = 0;
+  visPlugins.push_back(vis);
+}
+
+int VisHost::pluginCount() const
+{
+  return visPlugins.size();
 }
 
 int VisHost::init()
+{
+  for (unsigned int v=0; v<visPlugins.size(); v++)
+    if (!visPlugins[v].plugin && load(visPlugins[v])) return 1;
+  return 0;
+}
+
+int VisHost::load(VisLibrary &vis)
 {
   // load the visualization library
   if (verbose) cout << " * Loading visualization plugin..." << flush;
-  handle = dlopen(pluginPath.c_str(), RTLD_LAZY);
+  void *handle = dlopen(vis.path.c_str(), RTLD_LAZY);
   if (!handle) {
     cerr << "ERROR: Cannot load library: " << dlerror() << endl;
     return 1;
@@ -41,114 +262,1158 @@ int VisHost::init()
   if (dlsym_error) {
     cerr << "ERROR: Cannot load symbol create: " << dlsym_error << endl;
     dlclose(handle);
+    handle = NULL;
     return 1;
   }
-  destroy_plugin = (destroy_t*) dlsym(handle, "destroy");
+  destroy_t* destroy_plugin = (destroy_t*) dlsym(handle, "destroy");
   dlsym_error = dlerror();
   if (dlsym_error) {
     cerr << "ERROR: Cannot load symbol destroy: " << dlsym_error << endl;
     dlclose(handle);
+    handle = NULL;
     return 1;
   }
 
+  // plugins built before the interface was versioned don't export it
+  abi_version_t* abi_version = (abi_version_t*) dlsym(handle, "abi_version");
+  vis.abiVersion = abi_version ? abi_version() : 1;
+  dlerror();
+
   // create an instance of the class
-  visPlugin = create_plugin();
+  vis.handle = handle;
+  vis.destroy_plugin = destroy_plugin;
+  vis.plugin = create_plugin();
   if (verbose) cout << " [done]" << endl;
 
   return 0;
 }
 
+// take the analysis settings of another host
+void VisHost::copySettings(const VisHost &other)
+{
+  verbose = other.verbose;
+  singlePass = other.singlePass;
+  jobs = other.jobs;
+  shards = other.shards;
+  shardOverlap = other.shardOverlap;
+  cacheDir = other.cacheDir;
+  cacheSize = other.cacheSize;
+  explainPlan = other.explainPlan;
+  checkFFT = other.checkFFT;
+  readAhead = other.readAhead;
+  rangeStart = other.rangeStart;
+  rangeEnd = other.rangeEnd;
+  png = other.png;
+  imageFormat = other.imageFormat;
+}
+
 int VisHost::process(string wavfile)
 {
-  // open the .wav file
-  memset(&sfinfo, 0, sizeof(SF_INFO));
-  sndfile = sf_open(wavfile.c_str(), SFM_READ, &sfinfo);
-  if (!sndfile) {
-    cerr << "ERROR: Failed to open input file \""
-      << wavfile << "\": " << sf_strerror(sndfile) << endl;
-    return 1;
+  return process(AudioSource(wavfile));
+}
+
+// analyse audio from a file or memory. memory need only stay valid until
+// this returns
+int VisHost::process(const AudioSource &source_in)
+{
+  for (unsigned int v=0; v<visPlugins.size(); v++) {
+    if (!visPlugins[v].plugin) {
+      cerr << "ERROR: Visualization plugin is not loaded." << endl;
+      return 1;
+    }
   }
+
+  // forget the previous audio when the host is reused
+  vampResults.clear();
+  resultsFilt.clear();
+  resultsOutputs.clear();
+  audioHash = "";
+  delete pyramid;
+  pyramid = NULL;
+  pyramidKeys.clear();
+
+  // open the audio
+  source = source_in;
+  reader = source.open(&sfinfo);
+  if (!reader) return 1;
   sampleRate = sfinfo.samplerate;
 
-  // check channels
-  if (sfinfo.channels != 1) {
-    cerr << "ERROR: Only mono files currently supported." << endl;
-    return 1;
+  int status = analyse();
+  delete reader;
+  reader = NULL;
+  return status;
+}
+
+// the Vamp outputs a visualization plugin draws. plugins built against the
+// first version of the interface return them in its layout, so they are
+// read through it and given the defaults of the fields added since
+VisPlugin::VampOutputList VisHost::getVampPlugins(VisLibrary &vis)
+{
+  if (vis.abiVersion >= 2) return vis.plugin->getVampPlugins();
+
+  VisPluginV1 *legacy = reinterpret_cast<VisPluginV1*>(vis.plugin);
+  VisPluginV1::VampOutputList legacyOuts = legacy->getVampPlugins();
+  VisPlugin::VampOutputList outs;
+  for (unsigned int o=0; o<legacyOuts.size(); o++)
+  {
+    VisPlugin::VampOutput out;
+    out.plugin.name = legacyOuts[o].plugin.name;
+    out.plugin.blockSize = legacyOuts[o].plugin.blockSize;
+    out.plugin.stepSize = legacyOuts[o].plugin.stepSize;
+    out.plugin.parameters = legacyOuts[o].plugin.parameters;
+    out.plugin.channel = VAMP_DOWNMIX;
+    out.plugin.sequential = false;
+    out.plugin.targetSampleRate = 0;
+    out.name = legacyOuts[o].name;
+    outs.push_back(out);
+  }
+  return outs;
+}
+
+// run the Vamp plugins over the open audio
+int VisHost::analyse()
+{
+  // gather the outputs drawn by every visualization plugin
+  VisPlugin::VampOutputList vampOuts;
+  for (unsigned int v=0; v<visPlugins.size(); v++)
+  {
+    VisPlugin::VampOutputList outs = getVampPlugins(visPlugins[v]);
+    visPlugins[v].firstOutput = vampOuts.size();
+    visPlugins[v].outputs = outs.size();
+    vampOuts.insert(vampOuts.end(), outs.begin(), outs.end());
   }
 
-  // create set of unique plugins
-  VisPlugin::VampOutputList vampOuts = visPlugin->getVampPlugins();
+  // create set of unique plugins, where one requested both in sequence and
+  // not must see the whole file
   for (VisPlugin::VampOutputList::iterator o=vampOuts.begin();
        o!=vampOuts.end(); o++)
   {
-    VisPlugin::VampOutput out = *o;
-    vampPlugins.insert(out.plugin);
+    VisPlugin::VampPlugin plugin = o->plugin;
+    set<VisPlugin::VampPlugin>::iterator found = vampPlugins.find(plugin);
+    if (found != vampPlugins.end()) {
+      if (found->sequential || !plugin.sequential) continue;
+      vampPlugins.erase(found);
+    }
+    vampPlugins.insert(plugin);
   }
+  for (VisPlugin::VampOutputList::iterator o=vampOuts.begin();
+       o!=vampOuts.end(); o++)
+    o->plugin = *vampPlugins.find(o->plugin);
 
   // for each unique plugin
   for (set<VisPlugin::VampPlugin>::iterator p=vampPlugins.begin();
        p!=vampPlugins.end(); p++)
   {
     VisPlugin::VampPlugin plugin = *p;
-    if (verbose) cout << " * Processing Vamp plugin " << plugin.name << "..."
-      << flush;
 
-    // move to beginning of .wav file
-    sf_seek(sndfile, 0, SEEK_SET);
-
-    // initialise the plugin
-    vampHosts[plugin] = new VampHost(sndfile,
-                                     sfinfo,
-                                     plugin.name,
-                                     plugin.blockSize,
-                                     plugin.stepSize);
-
-    // set the parameters
-    for (VisPlugin::VampParameterList::iterator r=plugin.parameters.begin();
-        r!=plugin.parameters.end(); r++)
-    {
-      VisPlugin::VampParameter param = *r;
-      vampHosts[plugin]->setParameter(param.name, param.value);
+    // check channels
+    if (plugin.channel < VAMP_ALL_CHANNELS) {
+      cerr << "ERROR: Vamp plugin " << plugin.name << " requires channel "
+        << plugin.channel << ", which is not a channel number." << endl;
+      return 1;
     }
-
-    // process audio file
-    if (vampHosts[plugin]->run(vampResults[plugin])) {
-      cerr << "ERROR: Vamp plugin " << plugin.name
-        << " could not process audio." << endl;
+    if (plugin.channel > sfinfo.channels) {
+      cerr << "ERROR: Vamp plugin " << plugin.name << " requires channel "
+        << plugin.channel << " but the file only has " << sfinfo.channels
+        << "." << endl;
       return 1;
     }
-    if (verbose) cout << " [done]" << endl;
+
+    // keep the plugin loaded for a previous file if it analyses this one in
+    // the same way
+    VampHost *host = vampHosts[plugin];
+    if (host && (host->getSampleRate() != analysisRate(plugin) ||
+                 host->getInputChannels() != sfinfo.channels)) {
+      delete host;
+      vampHosts[plugin] = NULL;
+    }
+  }
+
+  // reuse the features of requests which have analysed this audio before,
+  // without loading their plugins
+  requested = vampOuts;
+  loaded.clear();
+  pyramidKeys.assign(vampOuts.size(), "");
+  if (!pyramidPath.empty()) loadPyramid(vampOuts);
+  if (!cacheDir.empty()) loadCached(vampOuts);
+
+  // run each plugin once for all of the other requests which analyse the
+  // audio the same way, only loading the plugins which will run and
+  // holding on to the features that will be rendered
+  if (plan(vampOuts)) return 1;
+  for (set<VisPlugin::VampPlugin>::iterator p=runs.begin(); p!=runs.end();
+       p++)
+  {
+    if (!vampHosts[*p]) vampHosts[*p] = createHost(*p);
+    if (!vampHosts[*p]) return 1;
+    if (verbose && analysisRate(*p) != sampleRate)
+      cout << " * Resampling to " << analysisRate(*p)
+        << "Hz for Vamp plugin " << p->name << endl;
+  }
+  for (set<VisPlugin::VampPlugin>::iterator p=vampPlugins.begin();
+       p!=vampPlugins.end(); p++)
+  {
+    delete vampSinks[*p];
+    vampSinks[*p] = NULL;
+    if (runs.count(*p))
+      vampSinks[*p] = new FeatureStoreSink(vampResults[*p],
+                                           analysisRate(*p));
+  }
+  for (VisPlugin::VampOutputList::iterator o=vampOuts.begin();
+       o!=vampOuts.end(); o++)
+  {
+    if (!runs.count(o->plugin)) continue;
+    int outNum = vampHosts[o->plugin]->findOutputNumber(o->name);
+    if (outNum < 0) return 1;
+    vampSinks[o->plugin]->keep(outNum);
+  }
+  pending = runs;
+
+  shareSpectra();
+  if (explainPlan) explain(vampOuts);
+
+  // analyse the audio
+  if (pending.empty()) {
+    if (verbose) cout << " * All Vamp plugin features already available"
+      << endl;
+  } else if (shards > 1) {
+    if (processSharded()) return 1;
+  } else if (singlePass) {
+    if (processSinglePass()) return 1;
+  } else if (jobs > 1) {
+    if (processParallel()) return 1;
+  } else {
+    if (processMultiPass()) return 1;
   }
 
+  if (checkFFT && compareFFT()) return 1;
+  if (cache && !audioHash.empty()) storeCached(vampOuts);
+
+  // report how much audio was copied to frame the plugins' blocks, which
+  // plugins sharing another's spectra don't do
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end() && verbose; p++)
+  {
+    if (shared.count(*p)) continue;
+    cout << " * Vamp plugin " << p->name << " copied "
+      << (long)vampHosts[*p]->getBytesCopiedPerSecond()
+      << " bytes per second of audio, where shifting an interleaved buffer "
+      << "would copy " << (long)vampHosts[*p]->getShiftedBytesPerSecond()
+      << endl;
+  }
+
+  // move each output's features into place, sharing the tables of those
+  // which were requested more than once
   int count=0;
+  map<pair<VisPlugin::VampPlugin, int>, int> moved;
   for (VisPlugin::VampOutputList::iterator o=vampOuts.begin();
        o!=vampOuts.end(); o++)
   {
     VisPlugin::VampOutput out = *o;
     if (verbose) cout << " * Refactoring data for "
       << out.plugin.name << ":" << out.name << "..." << flush;
-    unsigned int outNum = vampHosts[out.plugin]->findOutputNumber(out.name);
-    Plugin::FeatureList featList = vampResults[out.plugin][outNum];
-    resultsFilt[count] = featList;
+    int outNum = loaded.count(out.plugin) ? count :
+      vampHosts[out.plugin]->findOutputNumber(out.name);
+    pair<VisPlugin::VampPlugin, int> key(out.plugin, outNum);
+    if (!moved.count(key)) {
+      resultsFilt[count] = std::move(vampResults[out.plugin][outNum]);
+      moved[key] = count;
+    }
+    resultsOutputs.push_back(moved[key]);
     count++;
     if (verbose) cout << " [done]" << endl;
   }
 
+  if (!pyramidPath.empty() && !pyramid) storePyramid(vampOuts);
+
   return 0;
 }
 
-int VisHost::render(int width, int height, unsigned char *buffer)
+// the sample rate at which a Vamp plugin analyses the audio
+int VisHost::analysisRate(VisPlugin::VampPlugin plugin)
+{
+  if (plugin.targetSampleRate > 0) return plugin.targetSampleRate;
+  return sampleRate;
+}
+
+// load and configure a Vamp plugin, returning NULL if it can't be loaded.
+// frequency domain plugins are fed from the host's transform unless
+// hostFFT is false
+VampHost *VisHost::createHost(VisPlugin::VampPlugin plugin, bool hostFFT)
+{
+  // the plugin sees the audio at its own rate
+  SF_INFO info = sfinfo;
+  info.samplerate = analysisRate(plugin);
+  info.frames = Resampler::outputFrames(sfinfo.frames, sampleRate,
+                                        info.samplerate);
+
+  VampHost *host = new VampHost(info,
+                                plugin.name,
+                                plugin.blockSize,
+                                plugin.stepSize,
+                                plugin.channel,
+                                hostFFT);
+  if (!host->isLoaded()) {
+    delete host;
+    return NULL;
+  }
+
+  // set the parameters
+  for (VisPlugin::VampParameterList::iterator r=plugin.parameters.begin();
+      r!=plugin.parameters.end(); r++)
+  {
+    VisPlugin::VampParameter param = *r;
+    host->setParameter(param.name, param.value);
+  }
+
+  return host;
+}
+
+// the block and step sizes a Vamp plugin would analyse the audio with,
+// asking an instance of the same plugin already loaded at the same rate
+// rather than loading one for every request. returns 1 if the plugin can't
+// be loaded
+int VisHost::getFraming(VisPlugin::VampPlugin plugin, int *block, int *step)
+{
+  VampHost *host = NULL;
+  for (map<VisPlugin::VampPlugin, VampHost*>::iterator h=vampHosts.begin();
+       h!=vampHosts.end() && !host; h++)
+  {
+    if (h->second && !strcmp(h->first.name, plugin.name) &&
+        analysisRate(h->first) == analysisRate(plugin))
+      host = h->second;
+  }
+  if (!host) {
+    host = createHost(plugin);
+    if (!host) return 1;
+    vampHosts[plugin] = host;
+  }
+  host->getFraming(plugin.blockSize, plugin.stepSize, block, step);
+  return 0;
+}
+
+// everything about how a Vamp plugin analyses the audio, with its framing
+// as the plugin chose it and its parameters in order, so that requests
+// with the same key can share one run
+string VisHost::runKey(VisPlugin::VampPlugin plugin, int block, int step)
+{
+  VisPlugin::VampParameterList params = plugin.parameters;
+  sort(params.begin(), params.end());
+
+  // every channel of a mono file is the same channel
+  int channel = sfinfo.channels == 1 ? 1 : plugin.channel;
+
+  ostringstream key;
+  key.precision(9);
+  key << plugin.name << " block " << block << " step " << step
+    << " channel " << channel << " rate " << analysisRate(plugin);
+  for (unsigned int r=0; r<params.size(); r++)
+    key << " " << params[r].name << "=" << params[r].value;
+  return key.str();
+}
+
+// merge the requests for Vamp plugins which would analyse the audio in the
+// same way, such as one giving the plugin's preferred framing and another
+// leaving it to the plugin, pointing their outputs at a single run. returns
+// 1 if a plugin can't be loaded
+int VisHost::plan(VisPlugin::VampOutputList &outs)
+{
+  map<string, VisPlugin::VampPlugin> byKey;
+  map<VisPlugin::VampPlugin, string> keys;
+  for (set<VisPlugin::VampPlugin>::iterator p=vampPlugins.begin();
+       p!=vampPlugins.end(); p++)
+  {
+    if (loaded.count(*p)) continue;
+    int block, step;
+    if (getFraming(*p, &block, &step)) return 1;
+    string key = runKey(*p, block, step);
+    keys[*p] = key;
+    if (!byKey.count(key)) {
+      byKey[key] = *p;
+    } else if (p->sequential) {
+      // a run must see the whole file if any of its requests must
+      byKey[key].sequential = true;
+    }
+  }
+
+  runs.clear();
+  for (map<string, VisPlugin::VampPlugin>::iterator k=byKey.begin();
+       k!=byKey.end(); k++)
+    runs.insert(k->second);
+  for (unsigned int o=0; o<outs.size(); o++)
+    if (keys.count(outs[o].plugin))
+      outs[o].plugin = byKey[keys[outs[o].plugin]];
+  return 0;
+}
+
+// feed the frequency domain plugins which would window and transform the
+// same blocks from one transform. segments are analysed by separate
+// instances, so sharded runs transform their own blocks
+void VisHost::shareSpectra()
+{
+  shared.clear();
+  for (map<VisPlugin::VampPlugin, VampHost*>::iterator h=vampHosts.begin();
+       h!=vampHosts.end(); h++)
+    if (h->second) h->second->clearFollowers();
+  if (shards > 1) return;
+
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+  {
+    if (shared.count(*p)) continue;
+    VampHost *host = vampHosts[*p];
+    set<VisPlugin::VampPlugin>::iterator q = p;
+    for (q++; q!=pending.end(); q++)
+    {
+      if (shared.count(*q) || !host->canShareSpectra(*vampHosts[*q]))
+        continue;
+      host->shareSpectra(vampHosts[*q], vampSinks[*q]);
+      shared.insert(*q);
+      if (verbose) cout << " * Vamp plugin " << q->name
+        << " shares the spectra of " << p->name << endl;
+    }
+  }
+}
+
+// run each frequency domain plugin over the audio again, once fed from the
+// host's transform and once from the Vamp SDK's input domain adapter, and
+// report how far apart the features of each output drawn are. returns 1 if
+// any differ in number, timestamp or width, or in value by more than
+// FFT_CHECK_TOLERANCE
+int VisHost::compareFFT()
 {
+  set<VisPlugin::VampPlugin> checked = runs;
+  checked.insert(loaded.begin(), loaded.end());
+
+  int status = 0;
+  for (set<VisPlugin::VampPlugin>::iterator p=checked.begin();
+       p!=checked.end(); p++)
+  {
+    VampHost *hosts[2] = { createHost(*p), createHost(*p, false) };
+    if (!hosts[0] || !hosts[1] || !hosts[0]->usesHostFFT()) {
+      delete hosts[0];
+      delete hosts[1];
+      continue;
+    }
+
+    // the outputs drawn, by number and name
+    map<int, string> outputs;
+    for (unsigned int o=0; o<requested.size(); o++) {
+      if (requested[o].plugin < *p || *p < requested[o].plugin) continue;
+      int outNum = hosts[0]->findOutputNumber(requested[o].name);
+      if (outNum >= 0) outputs[outNum] = requested[o].name;
+    }
+
+    if (verbose) cout << " * Checking the FFT of Vamp plugin " << p->name
+      << "..." << flush;
+    FeatureStore results[2];
+    int failed = 0;
+    for (int h=0; h<2 && !failed; h++) {
+      FeatureStoreSink sink(results[h], analysisRate(*p));
+      for (map<int, string>::iterator o=outputs.begin(); o!=outputs.end();
+           o++)
+        sink.keep(o->first);
+      AudioReader *input = resample(reader, *p, sfinfo);
+      failed = input->rewind();
+      if (!failed) failed = hosts[h]->run(*input, sink);
+      if (input != reader) delete input;
+    }
+    delete hosts[0];
+    delete hosts[1];
+    if (failed) {
+      cerr << "ERROR: Vamp plugin " << p->name
+        << " could not process audio." << endl;
+      return 1;
+    }
+    if (verbose) cout << " [done]" << endl;
+
+    for (map<int, string>::iterator o=outputs.begin(); o!=outputs.end();
+         o++)
+    {
+      const FeatureTable &ours = results[0][o->first];
+      const FeatureTable &sdk = results[1][o->first];
+      bool same = ours.size() == sdk.size() &&
+        ours.positions == sdk.positions && ours.durations == sdk.durations;
+      double largest = 0;
+      for (size_t i=0; i<ours.size() && same; i++) {
+        same = ours.binCount(i) == sdk.binCount(i);
+        for (int b=0; b<ours.binCount(i) && same; b++) {
+          double expected = sdk.row(i)[b];
+          double diff = fabs(ours.row(i)[b] - expected) /
+            max(1.0, fabs(expected));
+          largest = max(largest, diff);
+        }
+      }
+      if (!same) {
+        cerr << "WARNING: Vamp plugin " << p->name << " output " << o->second;
+        if (ours.size() != sdk.size())
+          cerr << " has " << ours.size() << " features from the host's FFT "
+            << "but " << sdk.size() << " from the Vamp SDK's adapter" << endl;
+        else
+          cerr << " has features at other times or of other widths from the "
+            << "host's FFT than from the Vamp SDK's adapter" << endl;
+        status = 1;
+        continue;
+      }
+      cout << " * Vamp plugin " << p->name << " output " << o->second
+        << ": " << ours.size() << " features with the same timestamps, "
+        << "differing by at most " << largest << endl;
+      if (largest > FFT_CHECK_TOLERANCE) {
+        cerr << "WARNING: Vamp plugin " << p->name << " output " << o->second
+          << " differs from the Vamp SDK's adapter by more than "
+          << FFT_CHECK_TOLERANCE << endl;
+        status = 1;
+      }
+    }
+  }
+  return status;
+}
+
+// print the runs which the plan will make, where the features of each
+// are drawn from and what the analysis is expected to cost
+void VisHost::explain(VisPlugin::VampOutputList &outs)
+{
+  cout << "Analysis plan for " << sfinfo.frames << " frames of "
+    << sfinfo.channels << " channel audio at " << sampleRate << "Hz:"
+    << endl;
+
+  // requests read from the cache or a pyramid are listed as they were
+  // made, since their plugins aren't loaded
+  set<VisPlugin::VampPlugin> listed = runs;
+  listed.insert(loaded.begin(), loaded.end());
+
+  double total = 0;
+  for (set<VisPlugin::VampPlugin>::iterator p=listed.begin();
+       p!=listed.end(); p++)
+  {
+    VampHost *host = vampHosts[*p];
+    int rate = analysisRate(*p);
+    cout << "  " << p->name;
+    if (host) cout << " block " << host->getBlockSize() << " step "
+      << host->getStepSize();
+    else if (p->blockSize || p->stepSize) cout << " block " << p->blockSize
+      << " step " << p->stepSize;
+    cout << ", ";
+    if (p->channel == VAMP_ALL_CHANNELS) cout << "all channels";
+    else if (p->channel == VAMP_DOWNMIX) cout << "mixed to mono";
+    else cout << "channel " << p->channel;
+    cout << " at " << rate << "Hz" << endl;
+    for (VisPlugin::VampParameterList::const_iterator r=p->parameters.begin();
+         r!=p->parameters.end(); r++)
+      cout << "    parameter " << r->name << " = " << r->value << endl;
 
-  // set up memory for bitmap
+    // the outputs of the run and the visualizations which draw them
+    for (unsigned int o=0; o<outs.size(); o++)
+    {
+      if (outs[o].plugin < *p || *p < outs[o].plugin) continue;
+      for (unsigned int v=0; v<visPlugins.size(); v++) {
+        if ((int)o >= visPlugins[v].firstOutput &&
+            (int)o < visPlugins[v].firstOutput + visPlugins[v].outputs)
+          cout << "    output " << outs[o].name << " for "
+            << visPlugins[v].path << endl;
+      }
+    }
+
+    // the cost of a run is the number of samples in its blocks, counting
+    // each channel the plugin sees
+    if (!pending.count(*p)) {
+      cout << "    features from cache or peak pyramid" << endl;
+      continue;
+    }
+    sf_count_t frames = Resampler::outputFrames(sfinfo.frames, sampleRate,
+                                                rate);
+    sf_count_t steps = (frames + host->getStepSize() - 1) /
+      host->getStepSize();
+    int channels = p->channel == VAMP_ALL_CHANNELS ? sfinfo.channels : 1;
+    double samples = (double)steps * host->getBlockSize() * channels;
+    total += samples;
+    cout << "    " << steps << " blocks, " << (sf_count_t)samples
+      << " samples";
+    if (shared.count(*p)) cout << ", sharing another run's spectra";
+    cout << endl;
+  }
+
+  // how the runs still to be made will read the file
+  int passes = pending.size() - shared.size();
+  cout << "  " << vampPlugins.size() << " requests in " << listed.size()
+    << " runs, " << pending.size() << " to analyse";
+  if (pending.empty()) {
+    passes = 0;
+  } else if (shards > 1) {
+    cout << " in " << shards << " segments";
+  } else if (singlePass) {
+    cout << " in a single pass";
+    passes = 1;
+  } else if (jobs > 1) {
+    cout << " on " << min(jobs, (int)pending.size()) << " threads";
+  } else {
+    cout << " one after another";
+  }
+  cout << endl;
+  cout << "  Estimated cost: decoding the audio " << passes << " times, "
+    << (sf_count_t)total << " samples analysed ("
+    << (sfinfo.frames > 0 ? total / sfinfo.frames : 0)
+    << " times the length of the audio)" << endl;
+}
+
+// everything about how a Vamp plugin analyses the audio which its
+// features depend on, as it was requested, so that it can be found before
+// the plugin is loaded. the plugin's library stands in for its version.
+// empty if the library can't be found
+string VisHost::pluginKey(VisPlugin::VampPlugin plugin, string output)
+{
+  string library = VampHost::getLibraryStamp(plugin.name);
+  if (library.empty()) return "";
+  ostringstream key;
+  key.precision(9);
+  key << "plugin " << plugin.name << " " << library << "\n"
+    << "output " << output << "\n"
+    << "block " << plugin.blockSize << " step " << plugin.stepSize << "\n"
+    << "channel " << plugin.channel << " rate " << analysisRate(plugin)
+    << "\n";
+
+  // segments analysed by separate instances may differ where they meet
+  if (shards > 1 && !plugin.sequential && sfinfo.seekable)
+    key << "shards " << shards << " overlap " << shardOverlap << "\n";
+  for (VisPlugin::VampParameterList::iterator r=plugin.parameters.begin();
+      r!=plugin.parameters.end(); r++)
+    key << "param " << r->name << " " << r->value << "\n";
+  return key.str();
+}
+
+// the cache key of a plugin output's features, which holds everything that
+// they depend on
+string VisHost::cacheKey(VisPlugin::VampPlugin plugin, string output)
+{
+  string request = pluginKey(plugin, output);
+  if (request.empty()) return "";
+  ostringstream key;
+  key << "vampeyer-cache " << FEATURE_CACHE_VERSION << "\n"
+    << "audio " << audioHash << "\n"
+    << request;
+  return key.str();
+}
+
+// hash the content of the audio once for the cache and the peak pyramid,
+// returning false if it can't be read
+bool VisHost::hashAudio()
+{
+  if (!audioHash.empty()) return true;
+  if (verbose) cout << " * Hashing audio..." << flush;
+  audioHash = source.hash();
+  if (verbose) cout << (audioHash.empty() ? " [failed]" : " [done]") << endl;
+  return !audioHash.empty();
+}
+
+// fill in the results of requests whose outputs are all in the cache, by
+// the number of each output, and leave them out of the plan
+void VisHost::loadCached(VisPlugin::VampOutputList &outs)
+{
+  if (!hashAudio()) {
+    cerr << "WARNING: Could not hash audio, not using cache" << endl;
+    return;
+  }
+  if (!cache) cache = new FeatureCache(cacheDir, cacheSize);
+
+  for (set<VisPlugin::VampPlugin>::iterator p=vampPlugins.begin();
+       p!=vampPlugins.end(); p++)
+  {
+    if (loaded.count(*p)) continue;
+    bool hit = true;
+    for (unsigned int o=0; o<outs.size() && hit; o++)
+    {
+      if (outs[o].plugin < *p || *p < outs[o].plugin) continue;
+      string key = cacheKey(*p, outs[o].name);
+      hit = !key.empty() && cache->load(key, vampResults[*p][o]);
+    }
+    if (hit) {
+      if (verbose) cout << " * Loaded features of Vamp plugin " << p->name
+        << " from cache" << endl;
+      loaded.insert(*p);
+    } else {
+      vampResults[*p].clear();
+    }
+  }
+}
+
+// store the features of the plugins which were analysed, under the request
+// of each output
+void VisHost::storeCached(VisPlugin::VampOutputList &outs)
+{
+  for (unsigned int o=0; o<outs.size(); o++)
+  {
+    if (!pending.count(outs[o].plugin)) continue;
+    string key = cacheKey(requested[o].plugin, outs[o].name);
+    if (key.empty()) continue;
+    int outNum = vampHosts[outs[o].plugin]->findOutputNumber(outs[o].name);
+    cache->store(key, vampResults[outs[o].plugin][outNum]);
+  }
+  cache->evict();
+}
+
+// whether the visualization plugin drawing an output draws it from its
+// peaks
+bool VisHost::isPeakOutput(int output)
+{
+  for (unsigned int v=0; v<visPlugins.size(); v++) {
+    const VisLibrary &vis = visPlugins[v];
+    if (output < vis.firstOutput || output >= vis.firstOutput + vis.outputs)
+      continue;
+    return vis.abiVersion >= 3 &&
+      vis.plugin->getReduction(output - vis.firstOutput) == REDUCE_MINMAX;
+  }
+  return false;
+}
+
+// draw the peak outputs from a pyramid written for this audio before, if
+// it holds all of them, and remove the plugins which then have nothing
+// left to analyse
+void VisHost::loadPyramid(VisPlugin::VampOutputList &outs)
+{
+  pyramid = new PeakPyramid();
+  if (pyramid->open(pyramidPath)) {
+    delete pyramid;
+    pyramid = NULL;
+    return;
+  }
+
+  bool complete = hashAudio() &&
+    pyramid->matches(audioHash, sfinfo.frames, sfinfo.samplerate,
+                     sfinfo.channels);
+  set<VisPlugin::VampPlugin> needed;
+  for (unsigned int o=0; o<outs.size() && complete; o++) {
+    if (!isPeakOutput(o)) {
+      needed.insert(outs[o].plugin);
+      continue;
+    }
+    string key = pluginKey(outs[o].plugin, outs[o].name);
+    int levels = key.empty() ? -1 : pyramid->levels(key);
+    complete = levels >= 0;
+    if (levels > 0) pyramidKeys[o] = key;
+    else needed.insert(outs[o].plugin);
+  }
+  if (!complete) {
+    cerr << "WARNING: Peak pyramid " << pyramidPath << " does not match the "
+      "audio and plugins, writing it again" << endl;
+    pyramidKeys.assign(outs.size(), "");
+    delete pyramid;
+    pyramid = NULL;
+    return;
+  }
+
+  for (set<VisPlugin::VampPlugin>::iterator p=vampPlugins.begin();
+       p!=vampPlugins.end(); p++)
+  {
+    if (needed.count(*p)) continue;
+    if (verbose) cout << " * Read peaks of Vamp plugin " << p->name
+      << " from pyramid" << endl;
+    loaded.insert(*p);
+  }
+}
+
+// write the analysed peak outputs to a pyramid, and draw them from it
+void VisHost::storePyramid(VisPlugin::VampOutputList &outs)
+{
+  vector<string> keys;
+  vector<const FeatureTable*> tables;
+  set<string> stored;
+  for (unsigned int o=0; o<outs.size(); o++) {
+    if (!isPeakOutput(o)) continue;
+    string key = pluginKey(requested[o].plugin, outs[o].name);
+    if (key.empty() || !stored.insert(key).second) continue;
+    keys.push_back(key);
+    tables.push_back(&resultsFilt[resultsOutputs[o]]);
+  }
+  if (keys.empty()) {
+    cerr << "WARNING: Visualization plugin draws no peaks, not writing a "
+      "peak pyramid" << endl;
+    return;
+  }
+
+  if (!hashAudio()) {
+    cerr << "WARNING: Could not hash audio, not writing a peak pyramid"
+      << endl;
+    return;
+  }
+
+  if (verbose) cout << " * Writing peak pyramid..." << flush;
+  if (PeakPyramid::write(pyramidPath, keys, tables, audioHash, sfinfo.frames,
+                         sfinfo.samplerate, sfinfo.channels)) return;
+  pyramid = new PeakPyramid();
+  if (pyramid->open(pyramidPath)) {
+    delete pyramid;
+    pyramid = NULL;
+    return;
+  }
+  for (unsigned int o=0; o<outs.size(); o++) {
+    string key = pluginKey(requested[o].plugin, outs[o].name);
+    if (isPeakOutput(o) && !key.empty() && pyramid->levels(key) > 0)
+      pyramidKeys[o] = key;
+  }
+  if (verbose) cout << " [done]" << endl;
+}
+
+// decode the file once per plugin
+int VisHost::processMultiPass()
+{
+  if (verbose && reader->isMapped())
+    cout << " * Reading PCM directly from memory" << endl;
+
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+  {
+    VisPlugin::VampPlugin plugin = *p;
+    if (shared.count(plugin)) continue;
+    if (verbose) cout << " * Processing Vamp plugin " << plugin.name << "..."
+      << flush;
+
+    // move to beginning of .wav file
+    AudioReader *input = resample(reader, plugin, sfinfo);
+    AudioReader *ahead = decodeAhead(input, sfinfo.channels, readAhead);
+    int status = ahead->rewind();
+
+    // process audio file
+    if (!status) status = vampHosts[plugin]->run(*ahead, *vampSinks[plugin]);
+    if (ahead != input) delete ahead;
+    if (input != reader) delete input;
+    if (status) {
+      cerr << "ERROR: Vamp plugin " << plugin.name
+        << " could not process audio." << endl;
+      return 1;
+    }
+    if (verbose) cout << " [done]" << endl;
+  }
+
+  return 0;
+}
+
+// run the plugins on worker threads, each reading its own copy of the file
+int VisHost::processParallel()
+{
+  if (verbose) cout << " * Processing Vamp plugins on " << jobs
+    << " threads..." << flush;
+
+  // the results are created up front so that the workers never modify the
+  // map, which also keeps the output independent of the finishing order
+  vector<RunTask*> tasks;
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+    if (!shared.count(*p))
+      tasks.push_back(new RunTask(*p, vampHosts[*p], vampSinks[*p],
+                                  source, readAhead));
+
+  ThreadPool pool(min(jobs, (int)tasks.size()));
+  for (unsigned int t=0; t<tasks.size(); t++)
+    pool.add(tasks[t]);
+  pool.wait();
+
+  int status = 0;
+  for (unsigned int t=0; t<tasks.size(); t++) {
+    if (tasks[t]->status) {
+      cerr << "ERROR: Vamp plugin " << tasks[t]->plugin.name
+        << " could not process audio." << endl;
+      status = 1;
+    }
+    delete tasks[t];
+  }
+  if (!status && verbose) cout << " [done]" << endl;
+
+  return status;
+}
+
+// split the file into time segments which are analysed in parallel, each
+// with its own instance of the plugin
+int VisHost::processSharded()
+{
+  if (verbose) cout << " * Processing Vamp plugins in " << shards
+    << " segments..." << flush;
+
+  vector<ThreadPool::Task*> tasks;
+  vector<ShardTask*> shardTasks;
+  vector<RunTask*> runTasks;
+  vector<VampHost*> shardHosts;
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+  {
+    VampHost *host = vampHosts[*p];
+    int stepSize = host->getStepSize();
+    int rate = analysisRate(*p);
+    sf_count_t frames = Resampler::outputFrames(sfinfo.frames, sampleRate,
+                                                rate);
+    sf_count_t steps = (frames + stepSize - 1) / stepSize;
+    int segments = min((sf_count_t)shards, steps);
+
+    // plugins which must see the whole file are run as usual
+    if (p->sequential || !sfinfo.seekable || segments < 2) {
+      runTasks.push_back(new RunTask(*p, host, vampSinks[*p], source,
+                                     readAhead));
+      tasks.push_back(runTasks.back());
+      continue;
+    }
+
+    // warm each plugin up over a whole number of steps before its segment
+    sf_count_t overlap = (sf_count_t)ceil(shardOverlap * rate /
+      stepSize) * stepSize;
+
+    // segments begin on the step grid of a whole-file run
+    for (int s=0; s<segments; s++)
+    {
+      sf_count_t start = steps * s / segments * stepSize;
+      sf_count_t end = -1;
+      RealTime endTime = RealTime::zeroTime;
+      if (s < segments-1) {
+        end = steps * (s+1) / segments * stepSize;
+        endTime = RealTime::frame2RealTime(end, rate);
+      }
+
+      VampHost *segmentHost = host;
+      if (s > 0) {
+        segmentHost = createHost(*p);
+        shardHosts.push_back(segmentHost);
+      }
+
+      SegmentSink *sink = new SegmentSink(*vampSinks[*p],
+        RealTime::frame2RealTime(start, rate), endTime);
+      shardTasks.push_back(new ShardTask(*p, segmentHost, sink, source,
+                                         max((sf_count_t)0, start - overlap),
+                                         end, readAhead));
+      tasks.push_back(shardTasks.back());
+    }
+  }
+
+  ThreadPool pool(min(jobs > 1 ? jobs : shards, (int)tasks.size()));
+  for (unsigned int t=0; t<tasks.size(); t++)
+    pool.add(tasks[t]);
+  pool.wait();
+
+  // stitch the segments back together in order
+  int status = 0;
+  for (unsigned int t=0; t<shardTasks.size(); t++) {
+    if (shardTasks[t]->status) {
+      cerr << "ERROR: Vamp plugin " << shardTasks[t]->plugin.name
+        << " could not process audio." << endl;
+      status = 1;
+    }
+    shardTasks[t]->sink->flush();
+    delete shardTasks[t];
+  }
+  for (unsigned int t=0; t<runTasks.size(); t++) {
+    if (runTasks[t]->status) {
+      cerr << "ERROR: Vamp plugin " << runTasks[t]->plugin.name
+        << " could not process audio." << endl;
+      status = 1;
+    }
+    delete runTasks[t];
+  }
+  for (unsigned int h=0; h<shardHosts.size(); h++)
+    delete shardHosts[h];
+  if (!status && verbose) cout << " [done]" << endl;
+
+  return status;
+}
+
+// decode the file once and feed every plugin from the same blocks
+int VisHost::processSinglePass()
+{
+  if (verbose) cout << " * Processing Vamp plugins in a single pass..."
+    << flush;
+
+  // initialise every plugin before any audio is read, those sharing
+  // another's spectra along with it
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+  {
+    if (shared.count(*p)) continue;
+    if (vampHosts[*p]->initialise()) {
+      cerr << "ERROR: Vamp plugin " << p->name
+        << " could not be initialised." << endl;
+      return 1;
+    }
+  }
+
+  // plugins at the same rate share one resampled copy of each block
+  map<int, Stream> streams;
+  vector<BlockTask> tasks;
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+  {
+    if (shared.count(*p)) continue;
+    int rate = analysisRate(*p);
+    if (!streams.count(rate)) {
+      streams[rate].resampler = (rate == sampleRate) ? NULL :
+        new Resampler(sfinfo.channels, sampleRate, rate);
+    }
+    tasks.push_back(BlockTask(vampHosts[*p], vampSinks[*p], rate));
+  }
+
+  // share each decoded block between the plugins, running them in parallel
+  // if requested
+  ThreadPool pool(jobs > 1 ? min(jobs, (int)tasks.size()) : 0);
+  AudioReader *input = decodeAhead(reader, sfinfo.channels, readAhead);
+  int status = input->rewind();
+  const float *frames;
+  bool more = !status;
+  while (more)
+  {
+    int count = input->read(&frames);
+    more = count > 0;
+    if (count < 0) status = 1;
+
+    // resample the block, or at the end of the file the filters' tails
+    for (map<int, Stream>::iterator s=streams.begin(); s!=streams.end(); s++)
+    {
+      Stream &stream = s->second;
+      if (!stream.resampler) {
+        stream.frames = frames;
+        stream.count = count;
+      } else if (more) {
+        stream.count = stream.resampler->process(frames, count,
+                                                 &stream.frames);
+      } else {
+        stream.count = stream.resampler->flush(&stream.frames);
+      }
+    }
+
+    for (unsigned int t=0; t<tasks.size(); t++) {
+      Stream &stream = streams[tasks[t].rate];
+      if (stream.count <= 0) continue;
+      tasks[t].frames = stream.frames;
+      tasks[t].count = stream.count;
+      pool.add(&tasks[t]);
+    }
+    pool.wait();
+  }
+  if (input != reader) delete input;
+  for (map<int, Stream>::iterator s=streams.begin(); s!=streams.end(); s++)
+    delete s->second.resampler;
+  if (status) {
+    cerr << "ERROR: Could not decode audio." << endl;
+    return 1;
+  }
+
+  // flush the final blocks
+  for (set<VisPlugin::VampPlugin>::iterator p=pending.begin();
+       p!=pending.end(); p++)
+  {
+    if (shared.count(*p)) continue;
+    if (vampHosts[*p]->finish(*vampSinks[*p])) {
+      cerr << "ERROR: Vamp plugin " << p->name
+        << " could not process audio." << endl;
+      return 1;
+    }
+  }
+  if (verbose) cout << " [done]" << endl;
+
+  return 0;
+}
+
+// render the first visualization plugin's image
+int VisHost::render(int width, int height, unsigned char *buffer)
+{
   if (verbose) cout << " * Processing visualization..." << flush;
+  if (draw(0, width, height, buffer)) return 1;
+  if (verbose) cout << " [done]" << endl;
+  return 0;
+}
+
+// render the analysed audio into several images, such as different sizes
+// or different visualizations, on up to jobs threads. the images of a
+// plugin which isn't reentrant are drawn one after another
+int VisHost::render(vector<RenderTarget> &targets)
+{
+  if (verbose) cout << " * Processing " << targets.size()
+    << " visualizations..." << flush;
 
-  // get bitmap from library
-  if (visPlugin->ARGB(resultsFilt, width, height, buffer, sampleRate)) {
+  vector<RenderTask*> tasks;
+  map<int, RenderTask*> serial;
+  for (unsigned int t=0; t<targets.size(); t++) {
+    int plugin = targets[t].plugin;
+    const VisLibrary &vis = visPlugins[plugin];
+    if (vis.abiVersion >= 4 && vis.plugin->isReentrant()) {
+      tasks.push_back(new RenderTask(this));
+    } else if (!serial.count(plugin)) {
+      tasks.push_back(new RenderTask(this));
+      serial[plugin] = tasks.back();
+    }
+    RenderTask *task = serial.count(plugin) ? serial[plugin] : tasks.back();
+    task->targets.push_back(targets[t]);
+  }
+
+  int threads = min(jobs, (int)tasks.size());
+  ThreadPool pool(threads > 1 ? threads : 0);
+  for (unsigned int t=0; t<tasks.size(); t++)
+    pool.add(tasks[t]);
+  pool.wait();
+
+  int status = 0;
+  for (unsigned int t=0; t<tasks.size(); t++) {
+    if (tasks[t]->status) status = 1;
+    delete tasks[t];
+  }
+
+  if (!status && verbose) cout << " [done]" << endl;
+  return status;
+}
+
+// render one plugin's image, touching nothing but the image so that
+// several can be drawn at once
+int VisHost::draw(int plugin, int width, int height,
+                  unsigned char *buffer) const
+{
+  const VisLibrary &vis = visPlugins[plugin];
+
+  // point the plugin at the features in the time range, reduced to the
+  // width of the image where the plugin asks for it or read from the peak
+  // pyramid
+  vector<VisPlugin::FeatureView> views;
+  vector<FeatureTable> reduced(vis.outputs);
+  for (int o=0; o<vis.outputs; o++)
+  {
+    int output = vis.firstOutput + o;
+    const FeatureTable *features = &resultsFilt[resultsOutputs[output]];
+    size_t first, last;
+    features->range(rangeStart, rangeEnd, &first, &last);
+    int mode = vis.abiVersion >= 3 ? vis.plugin->getReduction(o) :
+      REDUCE_NONE;
+    if ((!pyramidKeys[output].empty() &&
+         pyramid->read(pyramidKeys[output], width, rangeStart, rangeEnd,
+                       reduced[o])) ||
+        features->reduce(width, mode, reduced[o], first, last)) {
+      features = &reduced[o];
+      first = 0;
+      last = features->size();
+    }
+    const FeatureTable &table = *features;
+    VisPlugin::FeatureView view;
+    view.values = table.values.data();
+    view.stride = max(table.bins, 0);
+    view.frames = last - first;
+    view.bins = table.bins;
+    view.offsets = table.bins < 0 ? table.offsets.data() + first : NULL;
+    if (table.bins >= 0) view.values += first * table.bins;
+    view.positions = table.positions.data() + first;
+    view.durations = table.durations.empty() ? NULL :
+      table.durations.data() + first;
+    view.labels = table.labels.empty() ? NULL : table.labels.data() + first;
+    view.sampleRate = table.sampleRate;
+    views.push_back(view);
+  }
+
+  // get bitmap from library, copying the features into a FeatureSet for
+  // plugins which predate renderARGB()
+  int status;
+  if (vis.abiVersion >= 2) {
+    status = vis.plugin->renderARGB(views.data(), views.size(), width,
+                                    height, buffer, sampleRate);
+  } else {
+    status = vis.plugin->VisPlugin::renderARGB(views.data(), views.size(),
+                                               width, height, buffer,
+                                               sampleRate);
+  }
+  if (status) {
     cerr << "ERROR: Plugin failed to produce bitmap." << endl;
     return 1;
   }
-  if (verbose) cout << " [done]" << endl;
 
   return 0;
 }
@@ -161,7 +1426,14 @@ VisHost::~VisHost()
   {
     VisPlugin::VampPlugin plugin = *p;
     delete vampHosts[plugin];
+    delete vampSinks[plugin];
+  }
+  delete cache;
+  delete pyramid;
+  delete reader;
+  for (unsigned int v=0; v<visPlugins.size(); v++) {
+    VisLibrary &vis = visPlugins[v];
+    if (vis.plugin) vis.destroy_plugin(vis.plugin);
+    if (vis.handle) dlclose(vis.handle);
   }
-  destroy_plugin(visPlugin);
-  dlclose(handle);
 }
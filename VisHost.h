@@ -18,31 +18,124 @@
 
 #include "VisPlugin.h"
 #include "VampHost.h"
+#include "ThreadPool.h"
+#include "Resampler.h"
+#include "AudioSource.h"
+#include "DecodeAheadReader.h"
+#include "FeatureCache.h"
+#include "PeakPyramid.h"
+#include "PNGWriter.h"
 #include <dlfcn.h>
 #include <string>
 
+// how far the features of a frequency domain plugin fed from the host's
+// transform may differ from those fed from the Vamp SDK's adapter, relative
+// to values above 1, before the comparison made by checkFFT fails
+#define FFT_CHECK_TOLERANCE 1e-4
+
+// an image for VisHost to render into
+struct RenderTarget
+{
+  int width;
+  int height;
+  unsigned char *buffer;
+  int plugin;     // which of the host's visualization plugins draws it
+};
+
+// a visualization plugin loaded by VisHost, and which of the host's Vamp
+// outputs it draws
+struct VisLibrary
+{
+  string path;
+  void* handle;
+  destroy_t* destroy_plugin;
+  VisPlugin* plugin;
+  int abiVersion;
+  int firstOutput;
+  int outputs;
+};
+
 class VisHost
 {
   protected:
-    void* handle;
-    destroy_t* destroy_plugin;
-    VisPlugin* visPlugin;
-    string pluginPath;
-    SNDFILE *sndfile;
+    vector<VisLibrary> visPlugins;
+    AudioSource source;
+    AudioReader *reader;
     SF_INFO sfinfo;
     int sampleRate;
-    Plugin::FeatureSet resultsFilt;
-    map<VisPlugin::VampPlugin, Plugin::FeatureSet > vampResults;
+    FeatureStore resultsFilt;
+    vector<int> resultsOutputs;  // table in resultsFilt of each output
+    map<VisPlugin::VampPlugin, FeatureStore> vampResults;
     map<VisPlugin::VampPlugin, VampHost*> vampHosts;
+    map<VisPlugin::VampPlugin, FeatureStoreSink*> vampSinks;
     set<VisPlugin::VampPlugin> vampPlugins;
+    set<VisPlugin::VampPlugin> runs;      // one of each set of plugins which
+                                          // analyse the audio the same way
+    set<VisPlugin::VampPlugin> loaded;    // requests whose features were
+                                          // read from the cache or pyramid
+    VisPlugin::VampOutputList requested;  // each output's request, before
+                                          // plan() merged them into runs
+    set<VisPlugin::VampPlugin> pending;   // plugins still to be analysed
+    set<VisPlugin::VampPlugin> shared;    // pending plugins fed from another
+                                          // plugin's spectra
+    FeatureCache *cache;
+    string audioHash;
+    PeakPyramid *pyramid;
+    vector<string> pyramidKeys;   // track of each output in the pyramid
+    int load(VisLibrary &vis);
+    VisPlugin::VampOutputList getVampPlugins(VisLibrary &vis);
+    VampHost *createHost(VisPlugin::VampPlugin plugin, bool hostFFT=true);
+    int analysisRate(VisPlugin::VampPlugin plugin);
+    int getFraming(VisPlugin::VampPlugin plugin, int *block, int *step);
+    string runKey(VisPlugin::VampPlugin plugin, int block, int step);
+    int plan(VisPlugin::VampOutputList &outs);
+    void explain(VisPlugin::VampOutputList &outs);
+    void shareSpectra();
+    int compareFFT();
+    bool hashAudio();
+    string pluginKey(VisPlugin::VampPlugin plugin, string output);
+    string cacheKey(VisPlugin::VampPlugin plugin, string output);
+    void loadCached(VisPlugin::VampOutputList &outs);
+    void storeCached(VisPlugin::VampOutputList &outs);
+    bool isPeakOutput(int output);
+    void loadPyramid(VisPlugin::VampOutputList &outs);
+    void storePyramid(VisPlugin::VampOutputList &outs);
+    int analyse();
+    int processMultiPass();
+    int processSinglePass();
+    int processParallel();
+    int processSharded();
+    int draw(int plugin, int width, int height, unsigned char *buffer) const;
+    friend class RenderTask;
 
   public:
     VisHost(string);
+    void addPlugin(string);
+    int pluginCount() const;
     int init();
+    void copySettings(const VisHost &other);
     int process(string);
+    int process(const AudioSource &source);
     int render(int width, int height, unsigned char*);
+    int render(vector<RenderTarget> &targets);
     ~VisHost();
     bool verbose;
+    bool singlePass;
+    int jobs;
+    int shards;
+    double shardOverlap;
+    string cacheDir;
+    off_t cacheSize;
+    string pyramidPath;
+    bool explainPlan;   // print how the audio will be analysed
+    bool checkFFT;      // compare the host's transform with the adapter's
+    int readAhead;      // blocks to decode ahead of the Vamp plugins, or 0
+                        // to decode on the threads running them
+    double rangeStart;
+    double rangeEnd;
+    PNGOptions png;     // how callers writing the image should encode it
+    int imageFormat;    // IMAGE_* to write it in, or IMAGE_AUTO to go by
+                        // the file name
 };
 
 #endif
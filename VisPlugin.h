@@ -18,11 +18,39 @@
 
 #include "vamp-hostsdk/Plugin.h"
 #include <cstring>
+#include <string>
 #include <vector>
+#include <stdint.h>
 
 using Vamp::Plugin;
 using Vamp::RealTime;
 
+// the version of this interface, which plugins built against it should
+// return from an exported abi_version() function; the host treats plugins
+// without one as version 1 and only calls the functions that existed then
+#define VISPLUGIN_ABI_VERSION 4
+
+// values of VampPlugin::channel other than a channel number (from 1)
+#define VAMP_DOWNMIX 0
+#define VAMP_ALL_CHANNELS -1
+
+// the name of the host's own peak analyser, which can stand in for a Vamp
+// plugin. its one output, "peaks", holds the minimum of every channel
+// followed by the maximum of every channel over each step
+#define PEAKS_PLUGIN "vampeyer:peaks"
+
+// ways the host can reduce an output with more rows than the image is wide
+// to one row per pixel column before rendering. each reduced row covers an
+// equal share of the rows and holds the minimum, maximum, mean or root mean
+// square of each bin over them, or for REDUCE_MINMAX the minimum of every
+// bin followed by the maximum of every bin
+#define REDUCE_NONE 0
+#define REDUCE_MIN 1
+#define REDUCE_MAX 2
+#define REDUCE_MEAN 3
+#define REDUCE_RMS 4
+#define REDUCE_MINMAX 5
+
 class VisPlugin
 {
   protected:
@@ -45,25 +73,41 @@ class VisPlugin
 
     typedef std::vector<VampParameter> VampParameterList;
 
-    typedef struct _VampPlugin
+    // VampPlugin and VampOutput have grown since the first version of the
+    // interface, so they are named differently from the structures that
+    // version used. a plugin built against it keeps its own code for them,
+    // rather than having it bound to the host's, and the host reads its
+    // requests in the old layout
+    typedef struct _VampPlugin2
     {
       const char *name;
       int blockSize;
       int stepSize;
       VampParameterList parameters;
-
-      bool operator<( const _VampPlugin &n ) const {
-        if (this->name < n.name) return true;
-        if (this->name > n.name) return false;
+      int channel;    // VAMP_DOWNMIX, VAMP_ALL_CHANNELS or a channel number
+      bool sequential;  // must see the whole file in order, so can't be
+                        // split into time segments and run in parallel
+      int targetSampleRate;  // analyse the audio resampled to this rate,
+                             // or at the file's rate if 0
+
+      // names are compared by value, as the same plugin may be named by
+      // different strings in different plugins
+      bool operator<( const _VampPlugin2 &n ) const {
+        int names = strcmp(this->name, n.name);
+        if (names != 0) return names < 0;
         if (this->blockSize < n.blockSize) return true;
         if (this->blockSize > n.blockSize) return false;
         if (this->stepSize < n.stepSize) return true;
         if (this->stepSize > n.stepSize) return false;
+        if (this->channel < n.channel) return true;
+        if (this->channel > n.channel) return false;
+        if (this->targetSampleRate < n.targetSampleRate) return true;
+        if (this->targetSampleRate > n.targetSampleRate) return false;
         return this->parameters < n.parameters;
       }
     } VampPlugin;
 
-    typedef struct _VampOutput
+    typedef struct _VampOutput2
     {
       VampPlugin plugin;
       const char *name;
@@ -71,6 +115,32 @@ class VisPlugin
 
     typedef std::vector<VampOutput> VampOutputList;
 
+    // a read-only view of the features of one Vamp plugin output, pointing
+    // into the host's own storage and valid for the duration of the call.
+    // row i holds binCount(i) values and is positioned at sample frame
+    // positions[i] at sampleRate
+    typedef struct _FeatureView
+    {
+      const float *values;
+      size_t stride;            // floats from the start of one row to the next
+      size_t frames;
+      int bins;                 // values in each row, or -1 if they vary
+      const int64_t *offsets;   // where each row starts and the last one ends
+                                // if bins vary, otherwise NULL
+      const int64_t *positions;
+      const int64_t *durations; // in frames, or -1 for none; NULL if no row
+                                // has a duration
+      const std::string *labels; // NULL if no row has a label
+      int sampleRate;
+
+      const float *row(size_t i) const {
+        return offsets ? values + offsets[i] : values + i * stride;
+      }
+      int binCount(size_t i) const {
+        return offsets ? (int)(offsets[i + 1] - offsets[i]) : bins;
+      }
+    } FeatureView;
+
     VisPlugin() {}
 
     virtual ~VisPlugin() {}
@@ -90,10 +160,59 @@ class VisPlugin
     }
 
     virtual double getVersion() const = 0;
+
+    // version 2: render straight from views of the features, one for each
+    // requested output, without copying them. by default the features are
+    // copied into a FeatureSet and passed to ARGB()
+    virtual int renderARGB(const FeatureView *features,
+                           int outputs,
+                           int width,
+                           int height,
+                           unsigned char *bitmap,
+                           int sampleRate)
+    {
+      Plugin::FeatureSet featureSet;
+      for (int o = 0; o < outputs; o++) {
+        const FeatureView &view = features[o];
+        Plugin::FeatureList &list = featureSet[o];
+        list.resize(view.frames);
+        for (size_t i = 0; i < view.frames; i++) {
+          Plugin::Feature &feature = list[i];
+          const float *values = view.row(i);
+          feature.hasTimestamp = true;
+          feature.timestamp = RealTime::frame2RealTime(view.positions[i],
+                                                       view.sampleRate);
+          feature.hasDuration = view.durations && view.durations[i] >= 0;
+          if (feature.hasDuration)
+            feature.duration = RealTime::frame2RealTime(view.durations[i],
+                                                        view.sampleRate);
+          feature.values.assign(values, values + view.binCount(i));
+          if (view.labels) feature.label = view.labels[i];
+        }
+      }
+      return ARGB(featureSet, width, height, bitmap, sampleRate);
+    }
+
+    // version 3: how the host should reduce each output, numbered in the
+    // order returned by getVampPlugins(), before it is passed to
+    // renderARGB(). outputs with varying numbers of bins are never reduced
+    virtual int getReduction(int output)
+    {
+      return REDUCE_NONE;
+    }
+
+    // version 4: whether renderARGB() and getReduction() can be called on
+    // several threads at once, so that images of several sizes can be
+    // rendered in parallel
+    virtual bool isReentrant()
+    {
+      return false;
+    }
 };
 
 // the types of the class factories
 typedef VisPlugin* create_t();
 typedef void destroy_t(VisPlugin*);
+typedef int abi_version_t();
 
 #endif
@@ -9,8 +9,8 @@ public:
         return 0.1;
     }
 
-    virtual int ARGB(Plugin::FeatureSet features, int width,
-        int height, unsigned char *bitmap, int sampleRate)
+    virtual int renderARGB(const FeatureView *features, int outputs,
+        int width, int height, unsigned char *bitmap, int sampleRate)
     {
       // set up cairo surface
       cairo_surface_t *surface;
@@ -32,11 +32,10 @@ public:
       cairo_move_to(cr, 0, 1);
 
       // draw amplitude
-      int frames = features[0].size();
+      int frames = features[0].frames;
       for (int frame=0; frame<frames; frame++)
       {
-        Plugin::Feature feats = features[0].at(frame);
-        double amp = feats.values[0];
+        double amp = features[0].row(frame)[0];
         cairo_line_to(cr, (double)frame/(double)frames, 1.0-amp);
       }
 
@@ -74,3 +73,7 @@ extern "C" VisPlugin* create() {
 extern "C" void destroy(VisPlugin* p) {
     delete p;
 }
+
+extern "C" int abi_version() {
+    return VISPLUGIN_ABI_VERSION;
+}
@@ -1,6 +1,7 @@
 #include "VisPlugin.h"
 #include <cairo/cairo.h>
 #include <math.h>
+#include <algorithm>
 
 #define MIN_FREQ 100
 #define MAX_FREQ 22050
@@ -53,8 +54,8 @@ public:
         return 0.1;
     }
 
-    virtual int ARGB(Plugin::FeatureSet features, int width,
-        int height, unsigned char *bitmap, int sampleRate)
+    virtual int renderARGB(const FeatureView *features, int outputs,
+        int width, int height, unsigned char *bitmap, int sampleRate)
     {
       const double lower = MIN_FREQ;
       const double higher = MAX_FREQ;
@@ -76,22 +77,26 @@ public:
       cairo_paint(cr);
 
       // find number of frames for peak/spec centroid
-      unsigned int peakFrames = features[0].size();
-      unsigned int scFrames = features[1].size();
+      unsigned int peakFrames = features[0].frames;
+      unsigned int scFrames = features[1].frames;
       double scScale = (double)scFrames/(double)peakFrames;
 
-      // for each peak frame, draw a colored line
+      // for each peak frame, draw a colored line between the lowest and
+      // highest peaks, which the host has already found for each pixel
+      // column of a long file
       for (unsigned int peakFrame=0; peakFrame<peakFrames; peakFrame++)
       {
         // find spectral contrast, clip and scale
-        double sc = features[1].at(floor(scScale*peakFrame)).values[0];
+        double sc = features[1].row(floor(scScale*peakFrame))[0];
         if (sc < lower) sc=lower;
         if (sc > higher) sc=higher;
         sc = (log10(sc)-lower_log)/(higher_log-lower_log);
 
         // get peak values
-        double peak1 = features[0].at(peakFrame).values[0];
-        double peak2 = features[0].at(peakFrame).values[1];
+        const float *values = features[0].row(peakFrame);
+        int count = features[0].binCount(peakFrame);
+        double peak1 = *std::min_element(values, values + count);
+        double peak2 = *std::max_element(values, values + count);
         
         // draw waveform
         cairo_set_source_rgba(cr, red(sc), green(sc), blue(sc), 1.0);
@@ -123,6 +128,12 @@ public:
       pluginList.push_back(specCent);
       return pluginList;
     }
+
+    // peaks keep their extremes and the centroid is averaged
+    virtual int getReduction(int output)
+    {
+      return output == 0 ? REDUCE_MINMAX : REDUCE_MEAN;
+    }
 };
 
 extern "C" VisPlugin* create() {
@@ -132,3 +143,7 @@ extern "C" VisPlugin* create() {
 extern "C" void destroy(VisPlugin* p) {
     delete p;
 }
+
+extern "C" int abi_version() {
+    return VISPLUGIN_ABI_VERSION;
+}
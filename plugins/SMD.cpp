@@ -179,3 +179,7 @@ extern "C" VisPlugin* create() {
 extern "C" void destroy(VisPlugin* p) {
     delete p;
 }
+
+extern "C" int abi_version() {
+    return VISPLUGIN_ABI_VERSION;
+}
@@ -11,7 +11,7 @@ public:
     }
 
     // This function returns a list of Vamp plugin outputs that should be
-    // extracted and supplied to the ARGB function, and defines how the Vamp
+    // extracted and supplied to the renderARGB function, and defines how the Vamp
     // plugins should be configured
     virtual VampOutputList getVampPlugins()
     {
@@ -30,10 +30,14 @@ public:
       pluginParams.push_back(thresh);
 
       // declare and initialize vamp plugin with
-      // defined block/step size and parameters
+      // defined block/step size and parameters, which only analyses the
+      // first channel of the audio (by default, VAMP_DOWNMIX, all of the
+      // channels are mixed down to mono, and VAMP_ALL_CHANNELS passes every
+      // channel to the plugin)
       VampPlugin pluginB = {"vamp-plugin-collection2:vamp-plugin-B",
                             1024, 512,
-                            pluginParams};
+                            pluginParams,
+                            1};
 
       // declare and initialize vamp plugin output 
       VampOutput outputB1 = {pluginB, "vamp-output"};
@@ -45,13 +49,34 @@ public:
       return pluginList;
     }
 
-    // This function takes the output of the Vamp plugins and returns a bitmap
-    // of a given width and height in 32-bit ARGB format
-    virtual int ARGB(Plugin::FeatureSet features,
-                     int width,
-                     int height,
-                     unsigned char *bitmap,
-                     int sampleRate)
+    // Optionally ask the host to reduce an output (numbered in the order of
+    // the list above) to one row per pixel column before it is rendered,
+    // so that drawing takes time in proportion to the width of the image
+    // rather than the length of the audio. Here the scalar first output is
+    // averaged over each column
+    virtual int getReduction(int output)
+    {
+      return output == 0 ? REDUCE_MEAN : REDUCE_NONE;
+    }
+
+    // Optionally tell the host that renderARGB can be called from several
+    // threads at once, so that several sizes of image can be drawn in
+    // parallel. This plugin keeps no state between calls, so it can
+    virtual bool isReentrant()
+    {
+      return true;
+    }
+
+    // This function takes read-only views of the output of the Vamp plugins
+    // and returns a bitmap of a given width and height in 32-bit ARGB format
+    // (older plugins implement ARGB instead, which receives a copy of the
+    // features as a FeatureSet)
+    virtual int renderARGB(const FeatureView *features,
+                           int outputs,
+                           int width,
+                           int height,
+                           unsigned char *bitmap,
+                           int sampleRate)
     {
       int frames, coeffs;
 
@@ -77,11 +102,11 @@ public:
       cairo_move_to(cr, 0, 1);
 
       // iterate over each frame for first output (a scalar)
-      frames = features[0].size();
+      frames = features[0].frames;
       for (int frame=0; frame<frames; frame++)
       {
         // extract the value and draw a line
-        double value = features[0].at(frame).values[0];
+        double value = features[0].row(frame)[0];
         cairo_line_to(cr, (double)frame/(double)frames, value);
       }
       
@@ -91,14 +116,14 @@ public:
       cairo_fill(cr);
 
       // iterate over each frame for second output (a vector)
-      frames = features[1].size();
-      coeffs = features[1].at(0).values.size();
+      frames = features[1].frames;
+      coeffs = features[1].bins;
       for (int frame=0; frame<frames; frame++)
       {
-        for (int coeff=0; coeff<coeffs; coeff+)
+        for (int coeff=0; coeff<coeffs; coeff++)
         {
           // extract the value and draw a rectangle
-          double value = features[1].at(frame).values.at(coeff);
+          double value = features[1].row(frame)[coeff];
           cairo_set_source_rgba(cr, value, value, value, 1);
           cairo_rectangle(cr, (double)frame/(double)frames,
                               (double)coeff/(double)coeffs,
@@ -123,3 +148,8 @@ extern "C" VisPlugin* create() {
 extern "C" void destroy(VisPlugin* p) {
     delete p;
 }
+
+// tells the host that renderARGB can be called
+extern "C" int abi_version() {
+    return VISPLUGIN_ABI_VERSION;
+}
@@ -1,6 +1,7 @@
 #include "VisPlugin.h"
 #include <cairo/cairo.h>
 #include <math.h>
+#include <algorithm>
 
 #define BG_COLOUR 0.866, 0.874, 0.882, 1
 #define WAVEFORM_COLOUR 0.38, 0.423, 1, 1
@@ -13,8 +14,8 @@ public:
         return 0.1;
     }
 
-    virtual int ARGB(Plugin::FeatureSet features, int width,
-        int height, unsigned char *bitmap, int sampleRate)
+    virtual int renderARGB(const FeatureView *features, int outputs,
+        int width, int height, unsigned char *bitmap, int sampleRate)
     {
       // set up cairo surface
       cairo_surface_t *surface;
@@ -34,14 +35,18 @@ public:
       cairo_set_line_width (cr, 1.0/(double)width);
 
       // find number of frames for peak/spec centroid
-      unsigned int peakFrames = features[0].size();
+      unsigned int peakFrames = features[0].frames;
 
-      // for each peak frame, draw a colored line
+      // for each peak frame, draw a colored line between the lowest and
+      // highest peaks, which the host has already found for each pixel
+      // column of a long file
       for (unsigned int peakFrame=0; peakFrame<peakFrames; peakFrame++)
       {
         // get peak values
-        double peak1 = features[0].at(peakFrame).values[0];
-        double peak2 = features[0].at(peakFrame).values[1];
+        const float *values = features[0].row(peakFrame);
+        int count = features[0].binCount(peakFrame);
+        double peak1 = *std::min_element(values, values + count);
+        double peak2 = *std::max_element(values, values + count);
         
         // draw waveform
         cairo_line_to(cr, (double)peakFrame/(double)peakFrames,
@@ -62,12 +67,23 @@ public:
     {
       VampOutputList pluginList;
 
-      VampPlugin bbcPeaks = {"bbc-vamp-plugins:bbc-peaks", 0, 0};
-      VampOutput peaks = {bbcPeaks, "peaks"};
+      // the host's own peak analyser, which needs no Vamp plugin
+      VampPlugin hostPeaks = {PEAKS_PLUGIN, 0, 0};
+      VampOutput peaks = {hostPeaks, "peaks"};
 
       pluginList.push_back(peaks);
       return pluginList;
     }
+
+    virtual int getReduction(int output)
+    {
+      return REDUCE_MINMAX;
+    }
+
+    virtual bool isReentrant()
+    {
+      return true;
+    }
 };
 
 extern "C" VisPlugin* create() {
@@ -77,3 +93,7 @@ extern "C" VisPlugin* create() {
 extern "C" void destroy(VisPlugin* p) {
     delete p;
 }
+
+extern "C" int abi_version() {
+    return VISPLUGIN_ABI_VERSION;
+}